@@ -6,6 +6,7 @@
 #define BUFFERSIZE 256
 
 typedef struct {
+  rtapi_task_struct *task;
   rtapi_integer period_nsec;
   char *addr;
   size_t size;
@@ -18,9 +19,7 @@ static void task_code(void *arg)
   size_t size;
   int count = 0;
   double sum = 0;
-  rtapi_integer start_secs, start_nsecs;
-  rtapi_integer now_secs, now_nsecs;
-  rtapi_integer diff_secs, diff_nsecs;
+  rtapi_int64 start_ns;
 
   period_nsec = ((args_struct *) arg)->period_nsec;
   addr = ((args_struct *) arg)->addr;
@@ -28,21 +27,17 @@ static void task_code(void *arg)
   
   rtapi_print("starting task with period nsecs %d, buffer size %d\n", (int) period_nsec, (int) size);
 
-  rtapi_clock_get_time(&start_secs, &start_nsecs);
+  start_ns = rtapi_clock_get_ns();
   
   for (;;) {
     count++;
     sum += sin(count);
     addr[0] = addr[size-1] = count;
-    rtapi_clock_get_time(&now_secs, &now_nsecs);
-    rtapi_clock_get_interval(start_secs, start_nsecs,
-			     now_secs, now_nsecs,
-			     &diff_secs, &diff_nsecs);
-    if (diff_secs >= 10) break;
+    if (rtapi_clock_get_ns() - start_ns >= 10000000000LL) break;
     rtapi_wait(period_nsec);
   }
 
-  rtapi_print("task done, count is %d, sum is %f\n", count, sum);
+  rtapi_print("task done, count is %d, sum is %f, overruns %d\n", count, sum, (int) rtapi_task_overruns(((args_struct *) arg)->task));
 
   exit(0);
 }
@@ -67,6 +62,11 @@ int rtapi_app_main(int argc, char **argv)
     return 1;
   }
   
+  /* let UL readers run in a known phase of our cycle */
+  rtapi_timebase_publish(period_nsec);
+  rtapi_task_set_phase(&task, 0);
+
+  args.task = &task;
   args.period_nsec = period_nsec;
   args.addr = rtapi_rtm_addr(rtm);
   args.size = BUFFERSIZE;
@@ -117,6 +117,12 @@ rtapi_result rtapi_clock_get_time(rtapi_integer *secs, rtapi_integer *nsecs)
 }
 EXPORT_SYMBOL(rtapi_clock_get_time);
 
+rtapi_int64 rtapi_clock_get_ns(void)
+{
+  return (rtapi_int64) rt_get_time_ns();
+}
+EXPORT_SYMBOL(rtapi_clock_get_ns);
+
 rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs,
 				      rtapi_integer start_nsecs,
 				      rtapi_integer end_secs,
@@ -237,6 +243,12 @@ rtapi_integer rtapi_task_stack_check(rtapi_task_struct *task)
 }
 EXPORT_SYMBOL(rtapi_task_stack_check);
 
+rtapi_integer rtapi_task_overruns(rtapi_task_struct *task)
+{
+  return -1;			/* RTAI doesn't count them for us */
+}
+EXPORT_SYMBOL(rtapi_task_overruns);
+
 rtapi_result rtapi_task_start(rtapi_task_struct *task,
 			      void (*taskcode)(void *),
 			      void *taskarg,
@@ -298,6 +310,30 @@ rtapi_result rtapi_task_set_period(rtapi_task_struct *task, rtapi_integer period
 }
 EXPORT_SYMBOL(rtapi_task_set_period);
 
+rtapi_result rtapi_task_set_cpus(rtapi_task_struct *task, const char *cpus)
+{
+  return RTAPI_IMPL_ERROR;
+}
+EXPORT_SYMBOL(rtapi_task_set_cpus);
+
+rtapi_result rtapi_task_set_name(rtapi_task_struct *task, const char *name)
+{
+  return RTAPI_IMPL_ERROR;
+}
+EXPORT_SYMBOL(rtapi_task_set_name);
+
+rtapi_result rtapi_timebase_publish(rtapi_int64 base_period_nsec)
+{
+  return RTAPI_IMPL_ERROR;
+}
+EXPORT_SYMBOL(rtapi_timebase_publish);
+
+rtapi_result rtapi_task_set_phase(rtapi_task_struct *task, rtapi_int64 offset_nsec)
+{
+  return RTAPI_IMPL_ERROR;
+}
+EXPORT_SYMBOL(rtapi_task_set_phase);
+
 rtapi_result rtapi_task_init(rtapi_task_struct *task)
 {
   return RTAPI_OK;
@@ -88,6 +88,9 @@ typedef int rtapi_flag;
 typedef char rtapi_flag;
 #endif
 
+/* 64-bit integer, e.g., for nanosecond times that won't wrap */
+typedef long long rtapi_int64;
+
 enum {
   RTAPI_OK = 0,
   RTAPI_ERROR,
@@ -124,9 +127,24 @@ extern rtapi_result rtapi_clock_set_period(rtapi_integer nsecs);
 /*! Global variable that holds the clock period */
 extern rtapi_integer rtapi_clock_period;
 
+/*!
+  Gets the time from a monotonic clock, with respect to some arbitrary
+  origin, as seconds and nanoseconds.
+*/
 extern rtapi_result rtapi_clock_get_time(rtapi_integer *secs,
 					 rtapi_integer *nsecs);
 
+/*!
+  Returns the time from the same monotonic clock as
+  rtapi_clock_get_time, as a single integer number of nanoseconds.
+  Intervals are then just the difference of two of these.
+*/
+extern rtapi_int64 rtapi_clock_get_ns(void);
+
+/*!
+  Computes the absolute value of the difference between the start
+  and end times as seconds and nanoseconds.
+*/
 extern rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs,
 					     rtapi_integer start_nsecs,
 					     rtapi_integer end_secs,
@@ -172,8 +190,9 @@ typedef RT_MUTEX rtapi_mutex_struct;
 
 #ifdef TARGET_UNIX
 
-#include <pthread.h>		/* pthread_t */
-typedef pthread_t rtapi_task_struct;
+#include <pthread.h>		/* pthread_mutex_t */
+#include "ulapi.h"		/* ulapi_task_struct */
+typedef ulapi_task_struct rtapi_task_struct;
 typedef pthread_mutex_t rtapi_mutex_struct;
 
 #endif
@@ -196,6 +215,10 @@ extern rtapi_result rtapi_task_start(rtapi_task_struct *task,
 				     rtapi_integer stacksize,
 				     rtapi_integer period_nsec,
 				     rtapi_flag uses_fp);
+/*!
+  In user space, asks the \a task to end at its next rtapi_wait rather
+  than cancelling it wherever it is, so it never ends holding a lock.
+*/
 extern rtapi_result rtapi_task_stop(rtapi_task_struct *task);
 extern rtapi_result rtapi_task_pause(rtapi_task_struct *task);
 extern rtapi_result rtapi_task_resume(rtapi_task_struct *task);
@@ -207,11 +230,49 @@ extern rtapi_result rtapi_task_set_period(rtapi_task_struct *task,
   pattern, 0xDEADBEEF, to which the stack was initialized on startup.
   Returns a positive number of stack words (typically integer size) if
   there is still stack to spare, 0 if the stack was overrwritten, or
-  -1 if the stack check is irrelevant on this platform.
+  -1 if the stack check is irrelevant on this platform. On Unix, stacks
+  are painted when a stack size is given, or in the real-time profile.
  */
 extern rtapi_integer rtapi_task_stack_check(rtapi_task_struct *task);
 
+/*!
+  Returns the number of releases a periodic task has missed, either
+  skipped or run late, or -1 if it isn't counted on this platform.
+ */
+extern rtapi_integer rtapi_task_overruns(rtapi_task_struct *task);
+
 extern rtapi_result rtapi_self_set_period(rtapi_integer period_nsec);
+
+/*!
+  Restricts the task to the CPUs in \a cpus, a list like "2,3" or
+  "2-5,7", or to any CPU if \a cpus is NULL or empty. If the task
+  hasn't been started yet, it starts on them.
+*/
+extern rtapi_result rtapi_task_set_cpus(rtapi_task_struct *task, const char *cpus);
+
+/*!
+  Names the task, for ulapi_task_list and tools like ultasks, and for
+  the thread name where the platform has one. In user space, a named
+  task is also started as its section of the ulapi_task_config file
+  says, if it has one.
+*/
+extern rtapi_result rtapi_task_set_name(rtapi_task_struct *task, const char *name);
+
+/*!
+  Publishes a time base shared with other processes, as with
+  ulapi_timebase_publish, and releases a periodic task at \a
+  offset_nsec past multiples of its period from its epoch, as with
+  ulapi_task_set_phase, so RT and UL processes can run in a fixed
+  order within a common cycle. Phases are only available on Unix;
+  elsewhere rtapi_task_set_phase returns RTAPI_IMPL_ERROR.
+*/
+extern rtapi_result rtapi_timebase_publish(rtapi_int64 base_period_nsec);
+extern rtapi_result rtapi_task_set_phase(rtapi_task_struct *task, rtapi_int64 offset_nsec);
+
+/*!
+  In a periodic task, waits for the task's next release. Where the
+  platform can't release tasks periodically, sleeps for \a period_nsec.
+*/
 extern rtapi_result rtapi_wait(rtapi_integer period_nsec);
 extern rtapi_result rtapi_task_exit(void);
 
@@ -154,6 +154,10 @@ module_param(name, int, 0)
 
 /*!
   The main application should call this before any RTAPI functions.
+  On Unix, tasks run under SCHED_FIFO if the environment variable
+  ULAPI_PROFILE is "rt", or if ulapi_init_profile(ULAPI_PROFILE_RT)
+  was called first, which also holds the CPUs out of deep idle states
+  for the life of the process.
  */
 extern int rtapi_app_init(int argc, char ** argv);
 #define rtapi_app_atexit(f) atexit(f)
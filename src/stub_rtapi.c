@@ -79,6 +79,11 @@ rtapi_result rtapi_clock_get_time(rtapi_integer * secs,
   return RTAPI_OK;
 }
 
+rtapi_int64 rtapi_clock_get_ns(void)
+{
+  return 0;
+}
+
 rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs, 
 				      rtapi_integer start_nsecs,
 				      rtapi_integer end_secs, 
@@ -86,27 +91,14 @@ rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs,
 				      rtapi_integer * diff_secs, 
 				      rtapi_integer * diff_nsecs)
 {
-  if (end_nsecs < start_nsecs) {
-    if (end_secs < start_secs) {
-      /* 1.1 - 9.9 */
-      *diff_nsecs = start_nsecs - end_nsecs;
-      *diff_secs = start_secs - end_secs;
-    } else {
-      /* 9.1 - 1.9 */
-      *diff_nsecs = 1e9 - start_nsecs + end_nsecs;
-      *diff_secs = end_secs - start_secs - 1;
-    }
-  } else {
-    if (end_secs < start_secs) {
-      /* 1.9 - 9.1 */
-      *diff_nsecs = 1e9 - end_nsecs + start_nsecs;
-      *diff_secs = start_secs - end_secs - 1;
-    } else {
-      /* 9.9 - 1.1 */
-      *diff_nsecs = end_nsecs - start_nsecs;
-      *diff_secs = end_secs - start_secs;
-    }
-  }
+  rtapi_int64 diff;
+
+  diff = ((rtapi_int64) end_secs - start_secs) * 1000000000 +
+    ((rtapi_int64) end_nsecs - start_nsecs);
+  if (diff < 0) diff = -diff;
+
+  *diff_secs = (rtapi_integer) (diff / 1000000000);
+  *diff_nsecs = (rtapi_integer) (diff % 1000000000);
 
   return RTAPI_OK;
 }
@@ -153,6 +145,26 @@ rtapi_result rtapi_task_set_period(void *task, rtapi_integer period_nsec)
   return RTAPI_OK;
 }
 
+rtapi_result rtapi_task_set_cpus(void *task, const char *cpus)
+{
+  return RTAPI_OK;
+}
+
+rtapi_result rtapi_task_set_name(void *task, const char *name)
+{
+  return RTAPI_OK;
+}
+
+rtapi_result rtapi_timebase_publish(rtapi_int64 base_period_nsec)
+{
+  return RTAPI_OK;
+}
+
+rtapi_result rtapi_task_set_phase(void *task, rtapi_int64 offset_nsec)
+{
+  return RTAPI_OK;
+}
+
 rtapi_result rtapi_task_init(void)
 {
   return RTAPI_OK;
@@ -178,6 +190,11 @@ rtapi_integer rtapi_task_stack_check(void *task)
   return -1;			/* irrelevant on this platform */
 }
 
+rtapi_integer rtapi_task_overruns(void *task)
+{
+  return -1;
+}
+
 rtapi_result rtapi_shm_alloc(rtapi_id key, rtapi_integer size, rtapi_id * id, void **ptr)
 {
   *id = 0;
@@ -83,11 +83,58 @@ typedef long double ulapi_real;
 typedef double ulapi_real;
 #endif
 
+/* 64-bit integer, e.g., for nanosecond times that won't wrap */
+typedef long long ulapi_int64;
+
 /*! Returns a real-valued number of seconds wiith respect
   to some arbitrary origin that remains constant for the life of the
   program. */
 extern ulapi_real ulapi_time(void);
 
+/*!
+  Returns an integer number of nanoseconds from a monotonic clock, with
+  respect to some arbitrary origin that remains constant for the life
+  of the program. Unlike ulapi_time, this doesn't lose precision as
+  the uptime grows, and differences are exact.
+
+  \note In the simulation build, libsimulapi.a, time is virtual. It
+  stands still while any task, or a thread that has started one, is
+  running, and when all are blocked in ulapi_wait, ulapi_sleep,
+  ulapi_task_join or ulapi_app_wait it jumps to the earliest wakeup,
+  so a simulated hour of 1 millisecond tasks takes only as long as
+  their work. A thread blocked anywhere else holds time still.
+  Software timers aren't available, and the shared time base is only
+  meaningful among threads of one process.
+*/
+extern ulapi_int64 ulapi_time_ns(void);
+
+/*!
+  Returns a free-running count of CPU timestamp cycles, much cheaper to
+  read than ulapi_time or ulapi_time_ns and intended for timestamping
+  hot paths. Uses the invariant TSC on x86 or the virtual counter on
+  ARM64, and falls back on the ulapi_time_ns clock otherwise, which is
+  also what it reads until ulapi_cycles_init has calibrated it.
+
+  \note In the simulation build, this is the virtual ulapi_time_ns
+  time, so that timestamps agree with the simulated schedule.
+*/
+extern ulapi_int64 ulapi_cycles(void);
+
+/*!
+  Calibrates ulapi_cycles against the ulapi_time_ns clock, which may
+  take some milliseconds, the first time it's called. It's called by
+  rtapi_app_init, when a periodic task is started and by
+  ulapi_exec_new, so that hot paths don't pay for it, and should be
+  called before taking timestamps anywhere else.
+*/
+extern ulapi_result ulapi_cycles_init(void);
+
+/*!
+  Converts a number of cycles, typically the difference of two
+  ulapi_cycles readings, to nanoseconds.
+*/
+extern ulapi_int64 ulapi_cycles_to_ns(ulapi_int64 cycles);
+
 /*!
   Returns a string version of the current time, e.g., 
   "1970-01-01T00:00:00Z", 
@@ -97,6 +144,24 @@ extern ulapi_real ulapi_time(void);
 */
 extern const char *ulapi_time_string(char *dst, size_t size);
 
+/*! Fractional-second precisions for ulapi_time_string_precise. */
+enum {
+  ULAPI_TIME_SEC = 0,
+  ULAPI_TIME_MSEC = 3,
+  ULAPI_TIME_USEC = 6,
+  ULAPI_TIME_NSEC = 9
+};
+
+/*!
+  Like ulapi_time_string, with \a digits of fractional seconds, e.g.,
+  "1970-01-01T00:00:00.123456Z" for ULAPI_TIME_USEC, and safe to call
+  from any number of threads. On Unix the string filled in if \a dst
+  is NULL is per thread, and the date and time are only formatted when
+  the second changes, so it's cheap enough to stamp every log line.
+  Returns NULL if \a size is too small.
+*/
+extern const char *ulapi_time_string_precise(char *dst, size_t size, ulapi_integer digits);
+
 /*! Puts the calling thread to sleep for a period of \a secs seconds. */
 extern void ulapi_sleep(ulapi_real secs);
 
@@ -122,6 +187,51 @@ enum {
 extern ulapi_result ulapi_init(void);
 extern ulapi_result ulapi_exit(void);
 
+/*!
+  Scheduling profiles. The real-time profile runs tasks under
+  SCHED_FIFO, mapping ulapi_prio_highest() through ulapi_prio_lowest()
+  onto its priorities, and needs root, CAP_SYS_NICE or a sufficient
+  RLIMIT_RTPRIO. The default is the normal profile, unless the
+  environment variable ULAPI_PROFILE is set to "rt".
+
+  The real-time profile also keeps the CPUs out of idle states slower
+  to leave than ULAPI_CPU_LATENCY microseconds, 0 if that's not set,
+  and warns about CPUs that real-time tasks are started on whose
+  frequency governor isn't "performance". Set ULAPI_CPU_LATENCY to -1
+  to leave the idle states alone.
+*/
+enum {
+  ULAPI_PROFILE_DEFAULT = 0,	/* from the environment, else as it was */
+  ULAPI_PROFILE_NORMAL,
+  ULAPI_PROFILE_RT
+};
+
+/*!
+  Like ulapi_init, also selecting the scheduling profile for tasks
+  started from now on. The profile stays selected through later calls
+  to ulapi_init, e.g., from rtapi_app_init. If the real-time profile
+  isn't permitted, says why on stderr, stays with the normal profile
+  and returns ULAPI_ERROR.
+*/
+extern ulapi_result ulapi_init_profile(ulapi_integer profile);
+extern ulapi_integer ulapi_get_profile(void);
+
+/*!
+  Asks, for as long as the process runs, that no CPU go into an idle
+  state that takes longer than \a usec microseconds to leave, through
+  /dev/cpu_dma_latency. A later call replaces the request, and a
+  negative \a usec withdraws it. Needs root, or write access to the
+  device.
+*/
+extern ulapi_result ulapi_cpu_latency_set(ulapi_integer usec);
+
+/*!
+  Fills in \a dst with the name of the frequency governor of CPU \a cpu,
+  e.g., "performance" or "powersave", returning ULAPI_ERROR if it has
+  no frequency scaling.
+*/
+extern ulapi_result ulapi_cpu_governor(ulapi_integer cpu, char *dst, size_t size);
+
 extern ulapi_integer ulapi_to_argv(const char *str, char ***argv);
 extern void ulapi_free_argv(ulapi_integer argc, char **argv);
 
@@ -167,6 +277,9 @@ extern ulapi_prio ulapi_prio_next_lower(ulapi_prio prio);
   the task information. Pass this to the \a ulapi_task_ functions.
 */
 
+/* room for task names, including the null */
+#define ULAPI_TASK_NAME_LEN 32
+
 #ifdef WIN32
 
 #include <windows.h>
@@ -188,7 +301,63 @@ typedef struct {
 
 #include <pthread.h>		/* pthread_t */
 
-typedef pthread_t ulapi_task_struct;
+/*
+  Tasks started with a non-zero period are released at absolute times
+  one period apart, so ulapi_wait() sleeps until the next release
+  rather than for a period after the work is done, and does not drift.
+*/
+typedef struct {
+  pthread_t tid;
+  void (*taskcode)(void *);
+  void *taskarg;
+  ulapi_integer period_nsec;	/* 0 means not periodic */
+  ulapi_integer next_period_nsec; /* takes effect at the next release */
+  ulapi_int64 release_ns;	/* absolute CLOCK_MONOTONIC release time */
+  ulapi_integer wait_mode;	/* ULAPI_WAIT_SLEEP or ULAPI_WAIT_HYBRID */
+  ulapi_flag slack_cut;		/* timer slack has been cut for hybrid waits */
+  ulapi_flag histograms;	/* non-zero means record the following */
+  void *latency_hist;		/* wakeup minus release, nsec */
+  void *exec_hist;		/* wakeup to next ulapi_wait, nsec */
+  ulapi_int64 wake_ns;		/* when the task last woke up */
+  ulapi_integer overrun_policy;	/* ULAPI_OVERRUN_ value */
+  ulapi_integer (*overrun_code)(void *task, ulapi_int64 late_nsec);
+  ulapi_int64 overruns;		/* releases missed or run late */
+  ulapi_int64 worst_overrun_ns;	/* latest the task has been for a release */
+  void *cpus;			/* cpu_set_t to start on, or NULL for any */
+  size_t stacksize;		/* requested, or 0 for the default */
+  void *stack;			/* our own painted stack, or NULL */
+  size_t stack_mapped;		/* its mapping, with the guard page */
+  ulapi_integer phase;		/* whether aligned to the shared time base */
+  ulapi_int64 phase_ns;		/* release offset from its epoch */
+  volatile int paused;		/* futex the task parks on while non-zero */
+  volatile int stop;		/* futex it sleeps on, set to ask it to end */
+  ulapi_int64 wcet_ns;		/* declared worst-case execution time, or 0 */
+  volatile ulapi_flag admitted;	/* from its start until it ends */
+  ulapi_int64 wake_cpu_ns;	/* its thread CPU time when it last woke */
+  ulapi_int64 cpu_min_ns;	/* least CPU time a cycle has taken */
+  ulapi_int64 cpu_max_ns;	/* and most */
+  ulapi_int64 cpu_sum_ns;	/* in all, over cpu_cycles */
+  ulapi_int64 cpu_cycles;
+  ulapi_int64 budget_ns;	/* CPU time per cycle, or 0 for no budget */
+  void (*budget_code)(void *task, ulapi_int64 cpu_nsec);
+  ulapi_int64 budget_overruns;	/* cycles that went over it */
+  char name[ULAPI_TASK_NAME_LEN];
+  ulapi_prio prio;
+  ulapi_integer policy;		/* ULAPI_POLICY_ value */
+  ulapi_int64 start_ns;		/* when it was started */
+  volatile ulapi_int64 cycles;	/* ulapi_waits it has returned from */
+  volatile ulapi_integer cpu;	/* it last woke up on */
+  volatile ulapi_integer state;	/* ULAPI_TASK_ value */
+  ulapi_integer os_tid;		/* the kernel's id for it, as in top -H */
+  ulapi_int64 cpu_ns;		/* CPU time it used, once it's done */
+  void *prog_cpus;		/* the above as the program set them, */
+  size_t prog_stacksize;	/* before the task configuration's */
+  ulapi_integer prog_policy;
+  ulapi_prio prog_prio;
+  ulapi_integer prog_period_nsec;
+  void *registry_next;		/* in the list of all tasks */
+  ulapi_flag registry_started;	/* listed only while started, not from ulapi_task_new */
+} ulapi_task_struct;
 
 typedef pthread_mutex_t ulapi_mutex_struct;
 
@@ -209,13 +378,322 @@ extern ulapi_result ulapi_task_start(ulapi_task_struct *task,
 				     ulapi_prio prio,
 				     ulapi_integer period_nsec);
 
+/*!
+  Asks the \a task to end, and returns without waiting for it. The task
+  ends at its next ulapi_wait or ulapi_sleep, waking early if it's
+  sleeping or paused in one, as if it had called ulapi_task_exit(-1),
+  so cleanup handlers it pushed with pthread_cleanup_push run and it's
+  never ended holding a lock. A task that waits elsewhere should poll
+  ulapi_self_stop_requested. Use ulapi_task_join or
+  ulapi_task_join_timeout to wait for it to end.
+*/
 extern ulapi_result ulapi_task_stop(ulapi_task_struct *);
+
+/*!
+  Returns non-zero if the calling task has been asked to stop, for
+  tasks that block somewhere other than ulapi_wait or ulapi_sleep.
+*/
+extern ulapi_flag ulapi_self_stop_requested(void);
+
+/*!
+  A last resort for a \a task that won't stop, such as one blocked in
+  a read: it is cancelled at its next cancellation point, typically a
+  blocking system call. Unlike ulapi_task_stop, locks it holds stay
+  held, so only use it on tasks that block outside of any lock.
+*/
+extern ulapi_result ulapi_task_kill(ulapi_task_struct *);
+
+/*!
+  Stops the \a task, killing it if it hasn't ended within \a
+  timeout_nsec, and starts it again as it was started. Returns
+  ULAPI_ERROR if it couldn't be ended, e.g., if it's blocked taking a
+  mutex, which isn't a cancellation point. Its cycle counts, overruns,
+  CPU statistics and histograms start again from nothing, as they do
+  whenever a task is started.
+*/
+extern ulapi_result ulapi_task_restart(ulapi_task_struct *, ulapi_int64 timeout_nsec);
+/*!
+  Pausing a task parks it at its next ulapi_wait, rather than wherever
+  it happens to be, so it never stops holding a lock or halfway through
+  its work. Resuming it lets it go at its next release on the schedule
+  it had, without counting the releases it missed as overruns.
+*/
 extern ulapi_result ulapi_task_pause(ulapi_task_struct *);
 extern ulapi_result ulapi_task_resume(ulapi_task_struct *);
+
+/*!
+  Names the task, for ulapi_task_list and, on Linux, for the thread
+  name shown by top, ps and gdb, which keeps the first 15 characters.
+*/
+extern ulapi_result ulapi_task_set_name(ulapi_task_struct *task, const char *name);
+
+/*!
+  Scheduling policies. The default is SCHED_FIFO in the real-time
+  profile, and otherwise whatever the starting thread has.
+*/
+enum {
+  ULAPI_POLICY_DEFAULT = 0,
+  ULAPI_POLICY_FIFO,
+  ULAPI_POLICY_RR,
+  ULAPI_POLICY_OTHER
+};
+
+extern ulapi_result ulapi_task_set_policy(ulapi_task_struct *task, ulapi_integer policy);
+
+/*!
+  Names an INI file whose sections configure tasks by name, or NULL
+  for none, so that priorities and CPU placement can be tuned for each
+  machine without rebuilding. If this isn't called, the file named by
+  the ULAPI_TASK_CONFIG environment variable is used, if it's set.
+  Starting a task that has a name looks for its section, e.g.,
+
+  [TASK servo]
+  PRIORITY = 2
+  PERIOD_NSEC = 1000000
+  CPUS = 2-3
+  STACKSIZE = 65536
+  POLICY = FIFO
+
+  and what's set there overrides what the task was started with. Any
+  of them may be left out, and one removed since the task was last
+  started no longer applies when it's restarted. PRIORITY is a ULAPI
+  priority, and POLICY is FIFO, RR, OTHER or DEFAULT. Names as long as
+  ULAPI_TASK_NAME_LEN are kept in full here, unlike thread names.
+*/
+extern ulapi_result ulapi_task_config(const char *path);
+
+/*! Task states, as reported by ulapi_task_list. */
+enum {
+  ULAPI_TASK_NEW = 0,		/* not started */
+  ULAPI_TASK_RUNNING,
+  ULAPI_TASK_WAITING,		/* in ulapi_wait, or ulapi_sleep */
+  ULAPI_TASK_PAUSED,
+  ULAPI_TASK_DONE
+};
+
+/*!
+  What's known about a task. The CPU is the one it last woke up on,
+  and cycles count its returns from ulapi_wait.
+*/
+typedef struct {
+  char name[ULAPI_TASK_NAME_LEN];
+  ulapi_integer os_tid;
+  ulapi_integer prio;
+  ulapi_integer period_nsec;
+  ulapi_integer cpu;
+  ulapi_integer state;
+  ulapi_int64 start_ns;
+  ulapi_int64 cycles;
+  ulapi_int64 cpu_ns;
+  ulapi_int64 overruns;
+} ulapi_task_info;
+
+/*!
+  Every task from ulapi_task_new, or rtapi_task_new, is kept in a
+  registry until it's deleted, and every other task while it's
+  started. Fills in \a info with up to \a max of them, and returns how
+  many there are in all.
+*/
+extern ulapi_integer ulapi_task_list(ulapi_task_info *info, ulapi_integer max);
+
+#define ULAPI_TASK_REGISTRY_KEY 0x554C5452
+/* unlike the key, so that any other segment there isn't taken for one */
+#define ULAPI_TASK_REGISTRY_MAGIC 0x52454731
+#define ULAPI_TASK_REGISTRY_MAX 128
+
+/*!
+  The registry as exported to shared memory. The sequence is odd while
+  it's being written, so a reader copies it out and tries again if the
+  sequence was odd or changed meanwhile.
+*/
+typedef struct {
+  ulapi_integer magic;
+  volatile ulapi_integer seq;
+  ulapi_integer pid;
+  ulapi_integer count;
+  ulapi_int64 updated_ns;
+  ulapi_task_info tasks[ULAPI_TASK_REGISTRY_MAX];
+} ulapi_task_registry;
+
+/*!
+  Copies the registry to the shared memory with \a key, e.g.,
+  ULAPI_TASK_REGISTRY_KEY, every \a period_nsec, for tools like
+  ultasks to read without stopping the process.
+*/
+extern ulapi_result ulapi_task_registry_export(ulapi_id key, ulapi_int64 period_nsec);
+
+/*!
+  Changes the period of a task. If the task is already periodic, the
+  new period takes effect at its next release.
+*/
 extern ulapi_result ulapi_task_set_period(ulapi_task_struct *, ulapi_integer period_nsec);
 extern ulapi_result ulapi_self_set_period(ulapi_integer period_nsec);
+
+/*!
+  Restricts the task to the CPUs in \a cpus, a list like "2,3" or
+  "2-5,7" as used by taskset -c and the kernel, or to any CPU if \a
+  cpus is NULL or empty. If the task isn't running, it starts on them
+  when it's next started or restarted.
+*/
+extern ulapi_result ulapi_task_set_cpus(ulapi_task_struct *task, const char *cpus);
+extern ulapi_result ulapi_self_set_cpus(const char *cpus);
+
+/*!
+  Releases the periodic task at \a offset_nsec past multiples of its
+  period from the epoch of the shared time base, so that tasks in
+  different processes run in a fixed order within a common cycle. If
+  the time base isn't published yet, the task runs as usual and falls
+  into phase once it is. Win32 tasks aren't released periodically, so
+  there it returns ULAPI_IMPL_ERROR.
+*/
+extern ulapi_result ulapi_task_set_phase(ulapi_task_struct *task, ulapi_int64 offset_nsec);
+
+/*!
+  Sets the stack size of a task not yet started. A task with a given
+  stack size, or any task in the real-time profile, gets a stack that's
+  painted with 0xDEADBEEF, and so prefaulted, and locked in memory
+  before it runs, so that its first cycles don't take page faults.
+  Real-time tasks without a stack size get 256 KB.
+*/
+extern ulapi_result ulapi_task_set_stacksize(ulapi_task_struct *task, size_t stacksize);
+
+/*!
+  Returns how many 4-byte words at the far end of the task's painted
+  stack have never been used, 0 if it has all been used, or -1 if the
+  stack wasn't painted. It's good until the task is cleared.
+*/
+extern ulapi_integer ulapi_task_stack_check(ulapi_task_struct *task);
+
+/*!
+  Fills in \a dst with the list of CPUs isolated from the scheduler,
+  e.g., with the isolcpus boot parameter, for real-time tasks to be
+  put on, or the list of the other online CPUs, for everything else.
+  The list is empty if there are none.
+*/
+extern ulapi_result ulapi_cpus_isolated(char *dst, size_t size);
+extern ulapi_result ulapi_cpus_housekeeping(char *dst, size_t size);
+
+/*!
+  In a periodic task, waits for the task's next release and ignores
+  \a period_nsec. Otherwise, sleeps for \a period_nsec nanoseconds.
+*/
 extern ulapi_result ulapi_wait(ulapi_integer period_nsec);
 
+enum {
+  ULAPI_WAIT_SLEEP = 0,		/* sleep until the release */
+  ULAPI_WAIT_HYBRID		/* sleep until a guard band before it, then spin */
+};
+
+/*!
+  Sets how the task waits for its releases in ulapi_wait. Hybrid
+  waits wake on time within the resolution of the clock, at the cost
+  of spinning through the guard band.
+*/
+extern ulapi_result ulapi_task_set_wait_mode(ulapi_task_struct *task, ulapi_integer mode);
+extern ulapi_result ulapi_self_set_wait_mode(ulapi_integer mode);
+
+/*!
+  Fixes the guard band of hybrid waits at \a guard_nsec, or with 0,
+  goes back to the guard band learned from the observed oversleep.
+  A process that made hybrid waits saves the learned value at exit, so
+  the user's next run starts with it, in $ULAPI_WAIT_FILE if that's
+  set, otherwise in $XDG_STATE_HOME/ulapi_wait or ~/.ulapi_wait.
+*/
+extern ulapi_result ulapi_wait_guard_set(ulapi_integer guard_nsec);
+
+/*!
+  Returns the guard band of hybrid waits now in effect, in nanoseconds.
+*/
+extern ulapi_integer ulapi_wait_guard_get(void);
+
+/*!
+  Turns on or off the recording of release latency and execution time
+  histograms for a periodic task. The latency is how late the task
+  woke up with respect to its scheduled release. The execution time
+  runs from the wakeup to the task's next call to ulapi_wait.
+*/
+extern ulapi_result ulapi_task_histograms(ulapi_task_struct *task, ulapi_flag on);
+
+/*!
+  Return the task's release latency or execution time histogram, for
+  use with the ulapi_histogram_ functions, or NULL if they were never
+  turned on.
+*/
+extern void *ulapi_task_latency_histogram(ulapi_task_struct *task);
+extern void *ulapi_task_exec_histogram(ulapi_task_struct *task);
+
+/*!
+  What a periodic task does when it calls ulapi_wait after its next
+  release has already passed.
+*/
+enum {
+  ULAPI_OVERRUN_CATCH_UP = 0,	/* run the late releases back to back */
+  ULAPI_OVERRUN_SKIP,		/* drop them and wait for the next one due */
+  ULAPI_OVERRUN_REPHASE,	/* drop them, run now and release from here */
+  ULAPI_OVERRUN_CALLBACK	/* ask the overrun code which of the above */
+};
+
+/*!
+  Sets the task's overrun policy, normally before it's started. With
+  ULAPI_OVERRUN_CALLBACK, \a code is called in the task with the task
+  and how late it is, and returns one of the other policies to apply.
+*/
+extern ulapi_result ulapi_task_set_overrun_policy(ulapi_task_struct *task, ulapi_integer policy, ulapi_integer (*code)(void *task, ulapi_int64 late_nsec));
+
+/*!
+  Returns the number of releases the task has missed, either skipped
+  or run late, and the latest it has been for a release, in nanoseconds.
+*/
+extern ulapi_int64 ulapi_task_overruns(ulapi_task_struct *task);
+extern ulapi_int64 ulapi_task_worst_overrun(ulapi_task_struct *task);
+
+/*!
+  Sets a budget of CPU time for each cycle of a periodic task, from
+  waking to its next ulapi_wait, counted in the thread's own CPU time
+  so that time spent preempted doesn't count against it. A cycle over
+  a non-zero \a budget_nsec is counted, and \a code, if not NULL, is
+  called in the task with the task and the CPU time the cycle took.
+*/
+extern ulapi_result ulapi_task_set_budget(ulapi_task_struct *task, ulapi_int64 budget_nsec, void (*code)(void *task, ulapi_int64 cpu_nsec));
+
+/*!
+  Gets the least, mean and most CPU time a periodic task's cycles have
+  taken, and how many went over its budget. Any pointer may be NULL.
+  Every periodic task keeps these, budget or not.
+*/
+extern ulapi_result ulapi_task_cpu_stats(ulapi_task_struct *task, ulapi_int64 *min_nsec, ulapi_int64 *mean_nsec, ulapi_int64 *max_nsec, ulapi_int64 *over_budget);
+
+/*!
+  Admission control. Starting a periodic task that's limited to one
+  CPU checks whether every periodic task limited to that CPU would
+  still respond within its period, by response-time analysis at their
+  fixed priorities, assuming the RT profile's SCHED_FIFO scheduling.
+  Each task's cost is the larger of its declared worst-case execution
+  time and the most CPU time a cycle of it has taken, as kept for
+  ulapi_task_cpu_stats.
+  A task with neither isn't checked, but nor does it delay the others.
+*/
+enum {
+  ULAPI_ADMIT_OFF = 0,		/* don't check */
+  ULAPI_ADMIT_WARN,		/* print why, and start it anyway, the default */
+  ULAPI_ADMIT_REFUSE		/* print why, and return ULAPI_ERROR */
+};
+
+extern ulapi_result ulapi_admission_set(ulapi_integer mode);
+
+/*!
+  Declares the task's worst-case execution time, for admission before
+  it has run. Measurements that exceed it take its place.
+*/
+extern ulapi_result ulapi_task_set_wcet(ulapi_task_struct *task, ulapi_int64 wcet_nsec);
+
+/*!
+  Rechecks the tasks limited to \a cpu, or to any CPU if \a cpu is
+  negative, with their costs as measured so far, warning about any
+  that could miss a release and returning ULAPI_ERROR if so.
+*/
+extern ulapi_result ulapi_admission_check(ulapi_integer cpu);
+
 /*!
   Terminates the calling task, saving \a retval for later reference by
   a task that may call \a ulapi_task_join.
@@ -227,8 +705,273 @@ extern void ulapi_task_exit(ulapi_integer retval);
   exit value into \a retval if \a retval is not NULL.
 */
 extern ulapi_result ulapi_task_join(ulapi_task_struct *, ulapi_integer *retval);
+
+/*!
+  As ulapi_task_join, but gives up and returns ULAPI_ERROR if the \a
+  task hasn't ended within \a timeout_nsec, leaving it joinable, so a
+  shutdown can stop a task and then fall back on ulapi_task_kill.
+*/
+extern ulapi_result ulapi_task_join_timeout(ulapi_task_struct *, ulapi_int64 timeout_nsec, ulapi_integer *retval);
 extern ulapi_integer ulapi_task_id(void);
 
+/*!
+  Log-linear histograms of nanosecond values. Recording is constant
+  time, and percentiles are accurate to within about 3 percent.
+  Returns a pointer to a new, empty histogram, or NULL on error.
+*/
+extern void *ulapi_histogram_new(void);
+extern ulapi_result ulapi_histogram_delete(void *hist);
+extern void ulapi_histogram_reset(void *hist);
+extern void ulapi_histogram_record(void *hist, ulapi_int64 value);
+extern ulapi_int64 ulapi_histogram_count(void *hist);
+extern ulapi_int64 ulapi_histogram_min(void *hist);
+extern ulapi_int64 ulapi_histogram_max(void *hist);
+extern ulapi_real ulapi_histogram_mean(void *hist);
+/*! Returns the value below which \a percent of the values lie. */
+extern ulapi_int64 ulapi_histogram_percentile(void *hist, ulapi_real percent);
+/*!
+  Prints a summary line of count, min, mean, percentiles and max,
+  then one line per non-empty bucket with the bucket's top value,
+  its count and the cumulative percent.
+*/
+extern ulapi_result ulapi_histogram_print(void *hist, FILE *fp);
+
+/*!
+  Software timers, for the many slow timeouts that don't each warrant
+  a task. Their code is run by one shared service thread, so it
+  should be short and must not block. Timers have a resolution of
+  1 millisecond and never run early.
+
+  Returns a new, unarmed timer that will call \a code with \a arg, or
+  NULL on error.
+*/
+extern void *ulapi_timer_new(void (*code)(void *arg), void *arg);
+
+/*!
+  Arms the timer to run \a delay_nsec from now and, if \a period_nsec
+  is non-zero, every \a period_nsec after that. Re-arming an armed
+  timer starts it over.
+*/
+extern ulapi_result ulapi_timer_arm(void *timer, ulapi_int64 delay_nsec, ulapi_int64 period_nsec);
+
+/*!
+  Disarms the timer. Its code may still be running if it was already due.
+*/
+extern ulapi_result ulapi_timer_cancel(void *timer);
+
+/*!
+  Disarms and frees the timer, waiting for its code to finish if it's
+  running, unless called from that code.
+*/
+extern ulapi_result ulapi_timer_delete(void *timer);
+
+/*!
+  Thread pools, for servers and the like that have many short jobs
+  and shouldn't start a task for each one.
+
+  Returns a new pool of \a workers tasks at priority \a prio, on the
+  CPUs in the list \a cpus, as for ulapi_task_set_cpus, or any CPU if
+  NULL. Returns NULL on error.
+*/
+extern void *ulapi_pool_new(ulapi_integer workers, ulapi_prio prio, const char *cpus);
+
+/*!
+  Runs whatever jobs are queued, then stops the workers and frees the
+  pool. Can't be called from one of the pool's own jobs.
+*/
+extern ulapi_result ulapi_pool_delete(void *pool);
+
+/*!
+  Queues \a code to be run with \a arg by one of the pool's workers,
+  counting it in \a group, if not NULL, for ulapi_pool_group_wait.
+  Jobs may submit more jobs.
+*/
+extern ulapi_result ulapi_pool_submit(void *pool, void *group, void (*code)(void *arg), void *arg);
+
+/*!
+  Groups of jobs to wait for together. Waiting returns once every job
+  submitted in the group so far has finished. A job that waits on a
+  group runs other jobs meanwhile, so waiting inside the pool doesn't
+  tie up a worker.
+*/
+extern void *ulapi_pool_group_new(void);
+extern ulapi_result ulapi_pool_group_wait(void *pool, void *group);
+extern ulapi_result ulapi_pool_group_delete(void *group);
+
+/*!
+  Fibers are cooperative loops that share one thread, for many slow
+  state machines that would each waste a thread of their own. Each is
+  written as a task would be, looping around ulapi_wait, which in a
+  fiber switches to whichever fiber is due next rather than blocking
+  the thread; ulapi_sleep does the same. The thread runs the earliest
+  release first and sleeps while none are due, so a fiber that doesn't
+  wait holds up all the others.
+
+  Returns a new scheduler whose fibers get stacks of \a stacksize
+  bytes, or 64 kilobytes if 0, or NULL on error.
+*/
+extern void *ulapi_fiber_sched_new(size_t stacksize);
+
+/*!
+  Frees the scheduler and any fibers left in it. Can't be called while
+  it's running, so stop and join its task first.
+*/
+extern ulapi_result ulapi_fiber_sched_delete(void *sched);
+
+/*!
+  Adds a fiber running \a code with \a arg, due at once. If \a
+  period_nsec is non-zero it's periodic, and each ulapi_wait parks it
+  until its next release, skipping any it has already missed by a
+  whole period. Otherwise ulapi_wait parks it for the period passed.
+  Fibers can be added before the scheduler runs, or by its own fibers.
+*/
+extern ulapi_result ulapi_fiber_add(void *sched, void (*code)(void *), void *arg, ulapi_integer period_nsec);
+
+/*!
+  Runs the scheduler's fibers until they have all returned, or until
+  its task is stopped. It's the code to pass ulapi_task_start, with the
+  scheduler as the argument, e.g.,
+
+  ulapi_task_start(task, ulapi_fiber_run, sched, prio, 0);
+*/
+extern void ulapi_fiber_run(void *sched);
+
+/*!
+  Returns the number of releases the calling fiber has skipped since
+  it was added, or 0 if the caller isn't a fiber.
+*/
+extern ulapi_int64 ulapi_fiber_overruns(void);
+
+/*!
+  A cyclic executive runs a table of functions on one task, each at a
+  multiple of a base period, in a fixed order within each base period,
+  or minor frame. Loops at harmonic rates that exchange data can then
+  share it without locks, and without switching threads.
+
+  Returns a new, empty executive with a minor frame of \a
+  base_period_nsec, or NULL on error.
+*/
+extern void *ulapi_exec_new(ulapi_integer base_period_nsec);
+extern ulapi_result ulapi_exec_delete(void *exec);
+
+/*!
+  Adds an entry that calls \a code with \a arg every \a multiple
+  minor frames, in those whose number is \a offset modulo \a
+  multiple, so that slower entries can be spread over the frames.
+  Entries due in a frame run in the order they were added, and are
+  numbered from 0 in that order for ulapi_exec_stats. Add them all
+  before the executive runs.
+*/
+extern ulapi_result ulapi_exec_add(void *exec, void (*code)(void *), void *arg, ulapi_integer multiple, ulapi_integer offset);
+
+/*!
+  Runs the executive, making the calling task periodic at the base
+  period. It's the code to start a task with, with the executive as
+  the argument, and runs until the task is stopped, between frames.
+*/
+extern void ulapi_exec_run(void *exec);
+
+/*!
+  Gets how many times entry \a index has run, and the least, mean and
+  most time it took, or with an \a index of -1 the same for whole
+  minor frames. Any pointer may be NULL.
+*/
+extern ulapi_result ulapi_exec_stats(void *exec, ulapi_integer index, ulapi_int64 *runs, ulapi_int64 *min_nsec, ulapi_int64 *mean_nsec, ulapi_int64 *max_nsec);
+
+/*!
+  A watchdog for tasks that stall, blocked, spinning or starved. Each
+  watched task pets its watch every cycle, and a monitor task reports
+  those that go longer than their deadline without, with where and
+  when they were last petted.
+
+  Starts the monitor, checking every \a period_nsec at priority \a
+  prio, which should be above the tasks it watches so it can't be
+  starved along with them.
+*/
+extern ulapi_result ulapi_watchdog_start(ulapi_integer period_nsec, ulapi_prio prio);
+extern ulapi_result ulapi_watchdog_stop(void);
+
+/*!
+  What the watchdog does about a stalled task, returned by the
+  escalation code.
+*/
+enum {
+  ULAPI_WATCH_LOG = 0,		/* report it, the default */
+  ULAPI_WATCH_IGNORE,		/* nothing, leaving it to the escalation code */
+  ULAPI_WATCH_STOP,		/* report it and stop its task */
+  ULAPI_WATCH_RESTART		/* report it and restart its task */
+};
+
+/*!
+  Returns a new watch called \a name, which must be petted at least
+  every \a deadline_nsec from now on. When it isn't, the monitor calls
+  \a escalate, if not NULL, with the watch, its name, its last label,
+  how far past its deadline it is and \a arg, and does what that
+  returns; otherwise it reports it. \a task is the task stopped or
+  restarted, and may be NULL. The escalation code is called with the
+  watch list locked, so it mustn't create or delete watches.
+*/
+extern void *ulapi_watch_new(ulapi_task_struct *task, const char *name, ulapi_int64 deadline_nsec, ulapi_integer (*escalate)(void *watch, const char *name, const char *label, ulapi_int64 late_nsec, void *arg), void *arg);
+extern ulapi_result ulapi_watch_delete(void *watch);
+
+/*!
+  Pets the watch, noting \a label as where the task is. The label
+  isn't copied, so it should be a string constant.
+*/
+extern void ulapi_watch_pet(void *watch, const char *label);
+
+/*!
+  Gets the label and ulapi_time_ns time the watch was last petted at.
+  The label is NULL if it hasn't been.
+*/
+extern ulapi_result ulapi_watch_last(void *watch, const char **label, ulapi_int64 *pet_ns);
+
+/*!
+  The shared memory key of the time base shared by processes on this
+  machine.
+*/
+#define ULAPI_TIMEBASE_KEY 0x554C5442
+
+/*!
+  Publishes the shared time base, with an epoch of now and a base
+  period of \a base_period_nsec, which tasks' periods should be
+  multiples of. If it's already published with that period, the epoch
+  is kept, so a restarted publisher stays in phase with the others.
+*/
+extern ulapi_result ulapi_timebase_publish(ulapi_int64 base_period_nsec);
+
+/*!
+  Gets the shared time base, returning ULAPI_ERROR if it hasn't been
+  published. The epoch is a ulapi_time_ns time.
+*/
+extern ulapi_result ulapi_timebase_get(ulapi_int64 *epoch_nsec, ulapi_int64 *base_period_nsec);
+
+/*!
+  Starts keeping cluster time, a clock shared by the nodes on the
+  multicast \a group, ULAPI_SOCKET_DEFAULT_MULTICAST_GROUP if NULL, at
+  UDP \a port. One node is the \a master, whose ulapi_time_ns is
+  cluster time. The others probe it every \a interval_nsec, and
+  estimate their offset and drift from it. On a quiet LAN this is good
+  to tens of microseconds.
+*/
+extern ulapi_result ulapi_timesync_start(ulapi_integer port, const char *group, ulapi_flag master, ulapi_int64 interval_nsec);
+extern ulapi_result ulapi_timesync_stop(void);
+
+/*!
+  Returns cluster time in nanoseconds, comparable across the nodes of
+  the cluster, and never going backwards. Until the first probe is
+  answered, or if ulapi_timesync_start wasn't called, it's this node's
+  ulapi_time_ns.
+*/
+extern ulapi_int64 ulapi_time_cluster_ns(void);
+
+/*!
+  Gets this node's estimated offset, cluster time less ulapi_time_ns,
+  the round trip of the probe it's based on, and the drift from the
+  master's clock, returning ULAPI_ERROR if not yet synchronized.
+*/
+extern ulapi_result ulapi_timesync_status(ulapi_int64 *offset_nsec, ulapi_int64 *delay_nsec, ulapi_real *drift_ppm);
+
 /*!
   Allocates a new process handle.
 */
@@ -308,6 +1051,11 @@ extern ulapi_result ulapi_cond_wait(void *cond, void *mutex);
   to get a pointer to the actual shared memory.
 */
 extern void *ulapi_shm_new(ulapi_id key, ulapi_integer size);
+/*!
+  As \a ulapi_shm_new, but only attaches to shared memory that has
+  already been created, returning NULL if there is none.
+*/
+extern void *ulapi_shm_attach(ulapi_id key, ulapi_integer size);
 /*!
   Returns a pointer to the actual shared memory, given a shared memory
   data structure previously created with \a ulapi_shm_new.
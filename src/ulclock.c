@@ -0,0 +1,377 @@
+/*!
+  \file ulclock.c
+
+  \brief A software clock shared by the nodes of a cluster, kept in
+  step with one master node by timestamped probes over UDP multicast.
+
+  Each other node sends the group a probe every interval, stamped
+  with its send time t1. The master stamps its receipt t2 and its
+  reply t3, and the node stamps the reply's receipt t4. As in NTP,
+  the master's clock is ahead by about ((t2 - t1) + (t3 - t4)) / 2,
+  with an error bounded by half the round trip (t4 - t1) - (t3 - t2).
+
+  Queueing only ever adds to the round trip, so the offset kept from
+  the last few probes is the one with the shortest. These filtered
+  offsets are then fit with a line against local time, whose slope is
+  the drift between the clocks, so that cluster time stays good
+  between probes and through a few lost ones.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>		/* NULL */
+#include <stdlib.h>		/* calloc, free */
+#include <string.h>		/* memset */
+#include "ulapi.h"
+
+/* "ULCS", so that strays on the port are ignored */
+#define SYNC_MAGIC 0x554C4353
+
+enum {SYNC_REQUEST = 1, SYNC_REPLY};
+
+/* the message fields, each sent as 8 bytes, most significant first */
+enum {F_MAGIC, F_TYPE, F_FROM, F_TO, F_SEQ, F_T1, F_T2, F_T3, F_COUNT};
+#define MSG_SIZE (F_COUNT * 8)
+
+/* raw probes the shortest round trip is picked from */
+#define FILTER_COUNT 8
+/* filtered offsets the drift is fit over */
+#define FIT_COUNT 32
+/* fits steeper than this, in parts per million, are taken as bad data */
+#define MAX_DRIFT_PPM 1000.0
+
+typedef struct {
+  ulapi_int64 at;		/* local time of t4 */
+  ulapi_int64 offset;
+  ulapi_int64 delay;
+} sample_struct;
+
+typedef struct {
+  ulapi_flag master;
+  ulapi_int64 interval_ns;
+  ulapi_integer out_fd;		/* multicaster */
+  ulapi_integer in_fd;		/* multicastee */
+  ulapi_int64 self;		/* our id in messages */
+  ulapi_task_struct *probe_task;
+  ulapi_task_struct *receive_task;
+  ulapi_mutex_struct *mutex;
+
+  /* the last probe sent, the only one whose reply is used */
+  volatile ulapi_int64 seq;
+
+  sample_struct filter[FILTER_COUNT];
+  ulapi_integer filter_count;
+  ulapi_integer filter_next;
+
+  sample_struct fit[FIT_COUNT];
+  ulapi_integer fit_count;
+  ulapi_integer fit_next;
+
+  /*
+    The model, offset(local) = base + mean + drift * (local - at_mean),
+    with the first offset taken out as 'base' to keep the fit well
+    conditioned across clocks that may be days apart.
+  */
+  ulapi_flag synced;
+  ulapi_int64 base;
+  ulapi_int64 at_mean;
+  ulapi_real mean;
+  ulapi_real drift;
+  ulapi_int64 delay;
+  ulapi_int64 last;		/* latest cluster time handed out */
+} sync_struct;
+
+static sync_struct *sync_state = NULL;
+
+static void put64(unsigned char *buf, ulapi_int64 v)
+{
+  int i;
+
+  for (i = 7; i >= 0; i--) {
+    buf[i] = (unsigned char) (v & 0xFF);
+    v = (ulapi_int64) (((unsigned long long) v) >> 8);
+  }
+}
+
+static ulapi_int64 get64(const unsigned char *buf)
+{
+  unsigned long long v = 0;
+  int i;
+
+  for (i = 0; i < 8; i++) v = (v << 8) | buf[i];
+
+  return (ulapi_int64) v;
+}
+
+static void sync_send(sync_struct *s, ulapi_int64 *fields)
+{
+  unsigned char buf[MSG_SIZE];
+  int i;
+
+  fields[F_MAGIC] = SYNC_MAGIC;
+  fields[F_FROM] = s->self;
+  for (i = 0; i < F_COUNT; i++) put64(buf + i * 8, fields[i]);
+
+  (void) ulapi_socket_write(s->out_fd, (const char *) buf, MSG_SIZE);
+}
+
+/* refits the model to the filtered offsets, with the mutex held */
+static void sync_fit(sync_struct *s)
+{
+  ulapi_real mx, my, sxx, sxy, dx;
+  ulapi_real drift;
+  ulapi_int64 at0;
+  int i;
+
+  at0 = s->fit[0].at;
+  mx = my = 0.0;
+  for (i = 0; i < s->fit_count; i++) {
+    mx += (ulapi_real) (s->fit[i].at - at0);
+    my += (ulapi_real) (s->fit[i].offset - s->base);
+  }
+  mx /= s->fit_count;
+  my /= s->fit_count;
+
+  sxx = sxy = 0.0;
+  for (i = 0; i < s->fit_count; i++) {
+    dx = (ulapi_real) (s->fit[i].at - at0) - mx;
+    sxx += dx * dx;
+    sxy += dx * ((ulapi_real) (s->fit[i].offset - s->base) - my);
+  }
+  drift = sxx > 0.0 ? sxy / sxx : 0.0;
+  if (drift > MAX_DRIFT_PPM * 1.0e-6 || drift < -MAX_DRIFT_PPM * 1.0e-6) drift = s->drift;
+
+  s->at_mean = at0 + (ulapi_int64) mx;
+  s->mean = my;
+  s->drift = drift;
+  s->synced = 1;
+}
+
+static void sync_sample(sync_struct *s, ulapi_int64 at, ulapi_int64 offset, ulapi_int64 delay)
+{
+  sample_struct *best;
+  int i;
+
+  if (delay < 0) return;
+
+  s->filter[s->filter_next].at = at;
+  s->filter[s->filter_next].offset = offset;
+  s->filter[s->filter_next].delay = delay;
+  s->filter_next = (s->filter_next + 1) % FILTER_COUNT;
+  if (s->filter_count < FILTER_COUNT) s->filter_count++;
+
+  best = &s->filter[0];
+  for (i = 1; i < s->filter_count; i++) {
+    if (s->filter[i].delay < best->delay) best = &s->filter[i];
+  }
+
+  ulapi_mutex_take(s->mutex);
+
+  /* the same best sample isn't fit twice */
+  i = (s->fit_next + FIT_COUNT - 1) % FIT_COUNT;
+  if (0 == s->fit_count || s->fit[i].at != best->at) {
+    if (0 == s->fit_count) s->base = best->offset;
+    s->fit[s->fit_next] = *best;
+    s->fit_next = (s->fit_next + 1) % FIT_COUNT;
+    if (s->fit_count < FIT_COUNT) s->fit_count++;
+    s->delay = best->delay;
+    sync_fit(s);
+  }
+
+  ulapi_mutex_give(s->mutex);
+}
+
+static void sync_receive_code(void *arg)
+{
+  sync_struct *s = (sync_struct *) arg;
+  unsigned char buf[MSG_SIZE];
+  ulapi_int64 fields[F_COUNT];
+  ulapi_int64 now;
+  ulapi_integer n;
+  int i;
+
+  for (;;) {
+    n = ulapi_socket_read(s->in_fd, (char *) buf, sizeof(buf));
+    now = ulapi_time_ns();
+    if (n < 0) break;
+    if (MSG_SIZE != n) continue;
+
+    for (i = 0; i < F_COUNT; i++) fields[i] = get64(buf + i * 8);
+    if (SYNC_MAGIC != fields[F_MAGIC] || s->self == fields[F_FROM]) continue;
+
+    if (s->master && SYNC_REQUEST == fields[F_TYPE]) {
+      fields[F_TYPE] = SYNC_REPLY;
+      fields[F_TO] = fields[F_FROM];
+      fields[F_T2] = now;
+      fields[F_T3] = ulapi_time_ns();
+      sync_send(s, fields);
+    } else if (! s->master && SYNC_REPLY == fields[F_TYPE] &&
+	       s->self == fields[F_TO] && s->seq == fields[F_SEQ]) {
+      sync_sample(s, now,
+		  ((fields[F_T2] - fields[F_T1]) + (fields[F_T3] - now)) / 2,
+		  (now - fields[F_T1]) - (fields[F_T3] - fields[F_T2]));
+    }
+  }
+}
+
+static void sync_probe_code(void *arg)
+{
+  sync_struct *s = (sync_struct *) arg;
+  ulapi_int64 fields[F_COUNT];
+
+  for (;;) {
+    memset(fields, 0, sizeof(fields));
+    fields[F_TYPE] = SYNC_REQUEST;
+    fields[F_SEQ] = ++s->seq;
+    /* stamped as late as possible, and echoed back in the reply */
+    fields[F_T1] = ulapi_time_ns();
+    sync_send(s, fields);
+    ulapi_wait((ulapi_integer) s->interval_ns);
+  }
+}
+
+/* returns NULL rather than a task that didn't start, so it's never stopped */
+static ulapi_task_struct *sync_task_start(void (*code)(void *), sync_struct *s, ulapi_integer period_nsec)
+{
+  ulapi_task_struct *task;
+
+  task = ulapi_task_new();
+  if (NULL == task) return NULL;
+
+  if (ULAPI_OK != ulapi_task_start(task, code, s, ulapi_prio_highest(), period_nsec)) {
+    ulapi_task_delete(task);
+    return NULL;
+  }
+
+  return task;
+}
+
+static void sync_free(sync_struct *s)
+{
+  if (NULL != s->probe_task) {
+    ulapi_task_stop(s->probe_task);
+    ulapi_task_join(s->probe_task, NULL);
+    ulapi_task_delete(s->probe_task);
+  }
+  if (NULL != s->receive_task) {
+    /* it's blocked in a read, and takes its mutex only between reads */
+    ulapi_task_kill(s->receive_task);
+    ulapi_task_join(s->receive_task, NULL);
+    ulapi_task_delete(s->receive_task);
+  }
+  if (s->in_fd >= 0) ulapi_socket_close(s->in_fd);
+  if (s->out_fd >= 0) ulapi_socket_close(s->out_fd);
+  if (NULL != s->mutex) ulapi_mutex_delete(s->mutex);
+  free(s);
+}
+
+ulapi_result ulapi_timesync_start(ulapi_integer port, const char *group, ulapi_flag master, ulapi_int64 interval_nsec)
+{
+  sync_struct *s;
+
+  if (NULL != sync_state) return ULAPI_ERROR;
+  if (port <= 0 || (! master && (interval_nsec <= 0 || interval_nsec > 0x7FFFFFFF))) {
+    return ULAPI_BAD_ARGS;
+  }
+
+  s = (sync_struct *) calloc(1, sizeof(sync_struct));
+  if (NULL == s) return ULAPI_ERROR;
+  s->master = master;
+  s->interval_ns = interval_nsec;
+  s->out_fd = s->in_fd = -1;
+  /* unique enough among nodes, and among processes on one */
+  s->self = (((ulapi_int64) ulapi_get_host_address()) << 32) ^ ulapi_time_ns();
+
+  s->mutex = ulapi_mutex_new(0);
+  s->out_fd = ulapi_socket_get_multicaster_id_on_interface(port, group);
+  s->in_fd = ulapi_socket_get_multicastee_id_on_interface(port, group);
+  if (NULL == s->mutex || s->out_fd < 0 || s->in_fd < 0) {
+    sync_free(s);
+    return ULAPI_ERROR;
+  }
+
+  /* stamps are taken in these, so they shouldn't wait behind others */
+  s->receive_task = sync_task_start(sync_receive_code, s, 0);
+  if (NULL == s->receive_task) {
+    sync_free(s);
+    return ULAPI_ERROR;
+  }
+
+  if (! master) {
+    s->probe_task = sync_task_start(sync_probe_code, s, (ulapi_integer) interval_nsec);
+    if (NULL == s->probe_task) {
+      sync_free(s);
+      return ULAPI_ERROR;
+    }
+  }
+
+  sync_state = s;
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_timesync_stop(void)
+{
+  if (NULL == sync_state) return ULAPI_OK;
+
+  sync_free(sync_state);
+  sync_state = NULL;
+
+  return ULAPI_OK;
+}
+
+ulapi_int64 ulapi_time_cluster_ns(void)
+{
+  sync_struct *s = sync_state;
+  ulapi_int64 now;
+  ulapi_int64 cluster;
+
+  now = ulapi_time_ns();
+  if (NULL == s || s->master) return now;
+
+  ulapi_mutex_take(s->mutex);
+  if (s->synced) {
+    cluster = now + s->base + (ulapi_int64) (s->mean + s->drift * (ulapi_real) (now - s->at_mean));
+    /* a refit may pull the estimate back, but time doesn't go back */
+    if (cluster < s->last) cluster = s->last;
+    s->last = cluster;
+  } else {
+    cluster = now;
+  }
+  ulapi_mutex_give(s->mutex);
+
+  return cluster;
+}
+
+ulapi_result ulapi_timesync_status(ulapi_int64 *offset_nsec, ulapi_int64 *delay_nsec, ulapi_real *drift_ppm)
+{
+  sync_struct *s = sync_state;
+  ulapi_int64 now;
+
+  if (NULL == s) return ULAPI_ERROR;
+
+  if (s->master) {
+    if (NULL != offset_nsec) *offset_nsec = 0;
+    if (NULL != delay_nsec) *delay_nsec = 0;
+    if (NULL != drift_ppm) *drift_ppm = 0.0;
+    return ULAPI_OK;
+  }
+
+  now = ulapi_time_ns();
+
+  ulapi_mutex_take(s->mutex);
+  if (! s->synced) {
+    ulapi_mutex_give(s->mutex);
+    return ULAPI_ERROR;
+  }
+  if (NULL != offset_nsec) {
+    *offset_nsec = s->base + (ulapi_int64) (s->mean + s->drift * (ulapi_real) (now - s->at_mean));
+  }
+  if (NULL != delay_nsec) *delay_nsec = s->delay;
+  if (NULL != drift_ppm) *drift_ppm = s->drift * 1.0e6;
+  ulapi_mutex_give(s->mutex);
+
+  return ULAPI_OK;
+}
@@ -0,0 +1,149 @@
+/*!
+  \file ulexec.c
+
+  \brief A cyclic executive, running a table of functions at multiples
+  of a base period on the one task that calls ulapi_exec_run.
+
+  Each base period is a minor frame. An entry with a multiple of N and
+  an offset of K runs in the frames whose number is K modulo N, and
+  the entries due in a frame run in the order they were added. Loops
+  that exchange data can then share it without locks, each seeing the
+  others' results from earlier in the frame or from the frame before,
+  always the same way round.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>		/* NULL */
+#include <stdlib.h>		/* calloc, realloc, free */
+#include "ulapi.h"
+
+typedef struct {
+  ulapi_int64 runs;
+  ulapi_int64 min_ns;
+  ulapi_int64 max_ns;
+  ulapi_int64 sum_ns;
+} exec_stats;
+
+typedef struct {
+  void (*code)(void *);
+  void *arg;
+  ulapi_integer multiple;
+  ulapi_integer offset;
+  exec_stats stats;
+} exec_entry;
+
+typedef struct {
+  ulapi_integer base_period_nsec;
+  exec_entry *entries;
+  ulapi_integer count;
+  exec_stats frame;		/* of whole minor frames */
+} exec_struct;
+
+static void stats_record(exec_stats *s, ulapi_int64 ns)
+{
+  if (0 == s->runs || ns < s->min_ns) s->min_ns = ns;
+  if (ns > s->max_ns) s->max_ns = ns;
+  s->sum_ns += ns;
+  s->runs++;
+}
+
+void *ulapi_exec_new(ulapi_integer base_period_nsec)
+{
+  exec_struct *x;
+
+  if (base_period_nsec <= 0) return NULL;
+
+  x = (exec_struct *) calloc(1, sizeof(exec_struct));
+  if (NULL == x) return NULL;
+
+  x->base_period_nsec = base_period_nsec;
+  /* now, not in the first frame, which would count it as an overrun */
+  (void) ulapi_cycles_init();
+
+  return x;
+}
+
+ulapi_result ulapi_exec_delete(void *exec)
+{
+  exec_struct *x = (exec_struct *) exec;
+
+  if (NULL == x) return ULAPI_OK;
+
+  free(x->entries);
+  free(x);
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_exec_add(void *exec, void (*code)(void *), void *arg, ulapi_integer multiple, ulapi_integer offset)
+{
+  exec_struct *x = (exec_struct *) exec;
+  exec_entry *entries;
+  exec_entry *e;
+
+  if (NULL == x || NULL == code || multiple < 1 || offset < 0 || offset >= multiple) {
+    return ULAPI_BAD_ARGS;
+  }
+
+  entries = (exec_entry *) realloc(x->entries, (x->count + 1) * sizeof(exec_entry));
+  if (NULL == entries) return ULAPI_ERROR;
+  x->entries = entries;
+
+  e = &x->entries[x->count];
+  e->code = code;
+  e->arg = arg;
+  e->multiple = multiple;
+  e->offset = offset;
+  e->stats.runs = e->stats.min_ns = e->stats.max_ns = e->stats.sum_ns = 0;
+  x->count++;
+
+  return ULAPI_OK;
+}
+
+void ulapi_exec_run(void *exec)
+{
+  exec_struct *x = (exec_struct *) exec;
+  exec_entry *e;
+  ulapi_int64 frame;
+  ulapi_int64 start, t0, t1;
+  ulapi_integer i;
+
+  if (NULL == x) return;
+
+  /* whatever the task was started with, the frames are the base period */
+  (void) ulapi_self_set_period(x->base_period_nsec);
+
+  for (frame = 0; ; frame++) {
+    start = t0 = ulapi_cycles();
+    for (i = 0; i < x->count; i++) {
+      e = &x->entries[i];
+      if (frame % e->multiple != e->offset) continue;
+      e->code(e->arg);
+      t1 = ulapi_cycles();
+      stats_record(&e->stats, ulapi_cycles_to_ns(t1 - t0));
+      t0 = t1;
+    }
+    stats_record(&x->frame, ulapi_cycles_to_ns(t0 - start));
+    /* a stop ends the task here, between frames */
+    ulapi_wait(x->base_period_nsec);
+  }
+}
+
+ulapi_result ulapi_exec_stats(void *exec, ulapi_integer index, ulapi_int64 *runs, ulapi_int64 *min_nsec, ulapi_int64 *mean_nsec, ulapi_int64 *max_nsec)
+{
+  exec_struct *x = (exec_struct *) exec;
+  exec_stats s;
+
+  if (NULL == x || index < -1 || index >= x->count) return ULAPI_BAD_ARGS;
+
+  s = (index < 0 ? x->frame : x->entries[index].stats);
+  if (NULL != runs) *runs = s.runs;
+  if (NULL != min_nsec) *min_nsec = s.min_ns;
+  if (NULL != mean_nsec) *mean_nsec = (0 == s.runs ? 0 : s.sum_ns / s.runs);
+  if (NULL != max_nsec) *max_nsec = s.max_ns;
+
+  return ULAPI_OK;
+}
@@ -0,0 +1,207 @@
+/*!
+  \file ulhist.c
+
+  \brief Log-linear histograms of nanosecond values, e.g., task wakeup
+  latencies and execution times.
+
+  Each power-of-two range of values is split into a fixed number of
+  equal-width sub-buckets, so the relative error of any recorded value
+  is bounded (about 3 percent here) from nanoseconds up to minutes,
+  with a constant-time record and a fixed-size table. This is the
+  bucketing used by HDR histograms.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>		/* FILE, fprintf */
+#include <stddef.h>		/* NULL */
+#include <stdlib.h>		/* calloc, free */
+#include <string.h>		/* memset */
+#include "ulapi.h"
+
+/* 2^SUB_BITS linear sub-buckets in each power-of-two range */
+#define SUB_BITS 5
+#define SUB_COUNT (1 << SUB_BITS)
+/* values of 2^MAX_BITS nsec (about 18 minutes) or more go in the last bucket */
+#define MAX_BITS 40
+#define BUCKET_COUNT ((MAX_BITS - SUB_BITS + 1) * SUB_COUNT)
+
+typedef struct {
+  ulapi_int64 count;
+  ulapi_int64 min;
+  ulapi_int64 max;
+  ulapi_real sum;
+  ulapi_int64 buckets[BUCKET_COUNT];
+} hist_struct;
+
+/* position of the most significant set bit of 'v' > 0 */
+static int msb(ulapi_int64 v)
+{
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll((unsigned long long) v);
+#else
+  int bit = 0;
+
+  while (v >>= 1) bit++;
+
+  return bit;
+#endif
+}
+
+static int value_to_index(ulapi_int64 value)
+{
+  int k;
+
+  if (value < SUB_COUNT) return (int) value;
+  if (value >= (((ulapi_int64) 1) << MAX_BITS)) return BUCKET_COUNT - 1;
+
+  /* value is in [2^k, 2^(k+1)), in sub-buckets 2^(k - SUB_BITS) wide */
+  k = msb(value);
+
+  return (k - SUB_BITS + 1) * SUB_COUNT +
+    (int) ((value >> (k - SUB_BITS)) - SUB_COUNT);
+}
+
+/* the highest value that would be counted in bucket 'index' */
+static ulapi_int64 index_to_value(int index)
+{
+  int k;
+  ulapi_int64 sub;
+
+  if (index < SUB_COUNT) return index;
+
+  k = index / SUB_COUNT + SUB_BITS - 1;
+  sub = index % SUB_COUNT + SUB_COUNT;
+
+  return ((sub + 1) << (k - SUB_BITS)) - 1;
+}
+
+void *ulapi_histogram_new(void)
+{
+  hist_struct *hist;
+
+  hist = (hist_struct *) calloc(1, sizeof(hist_struct));
+  if (NULL != hist) ulapi_histogram_reset(hist);
+
+  return hist;
+}
+
+ulapi_result ulapi_histogram_delete(void *hist)
+{
+  if (NULL != hist) free(hist);
+
+  return ULAPI_OK;
+}
+
+void ulapi_histogram_reset(void *hist)
+{
+  hist_struct *h = (hist_struct *) hist;
+
+  if (NULL == h) return;
+
+  memset(h, 0, sizeof(*h));
+  h->min = -1;
+}
+
+void ulapi_histogram_record(void *hist, ulapi_int64 value)
+{
+  hist_struct *h = (hist_struct *) hist;
+
+  if (NULL == h) return;
+
+  /* clock granularity can make an on-time value slightly negative */
+  if (value < 0) value = 0;
+
+  h->buckets[value_to_index(value)]++;
+  if (h->min < 0 || value < h->min) h->min = value;
+  if (value > h->max) h->max = value;
+  h->sum += value;
+  h->count++;
+}
+
+ulapi_int64 ulapi_histogram_count(void *hist)
+{
+  return NULL == hist ? 0 : ((hist_struct *) hist)->count;
+}
+
+ulapi_int64 ulapi_histogram_min(void *hist)
+{
+  hist_struct *h = (hist_struct *) hist;
+
+  return (NULL == h || h->min < 0) ? 0 : h->min;
+}
+
+ulapi_int64 ulapi_histogram_max(void *hist)
+{
+  return NULL == hist ? 0 : ((hist_struct *) hist)->max;
+}
+
+ulapi_real ulapi_histogram_mean(void *hist)
+{
+  hist_struct *h = (hist_struct *) hist;
+
+  if (NULL == h || 0 == h->count) return 0;
+
+  return h->sum / h->count;
+}
+
+ulapi_int64 ulapi_histogram_percentile(void *hist, ulapi_real percent)
+{
+  hist_struct *h = (hist_struct *) hist;
+  ulapi_int64 target;
+  ulapi_int64 sum;
+  ulapi_int64 value;
+  int t;
+
+  if (NULL == h || 0 == h->count) return 0;
+
+  if (percent <= 0) return ulapi_histogram_min(h);
+  if (percent >= 100) return h->max;
+
+  target = (ulapi_int64) (h->count * percent / 100.0 + 0.5);
+  if (target < 1) target = 1;
+
+  for (sum = 0, t = 0; t < BUCKET_COUNT; t++) {
+    sum += h->buckets[t];
+    if (sum >= target) {
+      value = index_to_value(t);
+      /* the bucket's top may be past anything actually recorded */
+      return value > h->max ? h->max : value;
+    }
+  }
+
+  return h->max;
+}
+
+ulapi_result ulapi_histogram_print(void *hist, FILE *fp)
+{
+  hist_struct *h = (hist_struct *) hist;
+  ulapi_int64 sum;
+  int t;
+
+  if (NULL == h || NULL == fp) return ULAPI_BAD_ARGS;
+
+  fprintf(fp, "count %lld min %lld mean %.0f p50 %lld p90 %lld p99 %lld p99.9 %lld max %lld\n",
+	  (long long) h->count,
+	  (long long) ulapi_histogram_min(h),
+	  (double) ulapi_histogram_mean(h),
+	  (long long) ulapi_histogram_percentile(h, 50),
+	  (long long) ulapi_histogram_percentile(h, 90),
+	  (long long) ulapi_histogram_percentile(h, 99),
+	  (long long) ulapi_histogram_percentile(h, 99.9),
+	  (long long) h->max);
+
+  /* one line per non-empty bucket: upper value, count, cumulative percent */
+  for (sum = 0, t = 0; t < BUCKET_COUNT; t++) {
+    if (0 == h->buckets[t]) continue;
+    sum += h->buckets[t];
+    fprintf(fp, "%lld %lld %.3f\n",
+	    (long long) index_to_value(t),
+	    (long long) h->buckets[t],
+	    100.0 * sum / h->count);
+  }
+
+  return ULAPI_OK;
+}
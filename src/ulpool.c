@@ -0,0 +1,393 @@
+/*!
+  \file ulpool.c
+
+  \brief A fixed pool of worker tasks that run submitted jobs, so that
+  servers don't start a task per request.
+
+  Each worker has its own double-ended queue of jobs. Jobs submitted
+  from a worker go on the bottom of its own queue, which it takes from
+  last in first out while the jobs' data is still in its cache. Jobs
+  from outside go round the workers in turn. A worker whose queue is
+  empty steals from the top of the others' queues, the oldest jobs,
+  before going to sleep, so bursts spread over the pool without one
+  shared queue everyone contends on.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>		/* NULL */
+#include <stdlib.h>		/* malloc, calloc, free */
+#include <pthread.h>
+#include "ulapi.h"
+
+typedef struct job_struct {
+  void (*code)(void *);
+  void *arg;
+  struct group_struct *group;
+} job_struct;
+
+typedef struct group_struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t done;
+  ulapi_integer count;		/* submitted and not yet finished */
+} group_struct;
+
+/*
+  Top and bottom are only changed under the mutex, but are stored
+  atomically so that thieves can peek at them without it.
+*/
+typedef struct {
+  pthread_mutex_t mutex;
+  job_struct **jobs;		/* a ring whose size is a power of two */
+  unsigned int size;
+  unsigned int top;		/* stolen from here */
+  unsigned int bottom;		/* pushed and popped by the owner here */
+} deque_struct;
+
+struct pool_struct;
+
+typedef struct {
+  struct pool_struct *pool;
+  ulapi_integer index;
+  ulapi_task_struct *task;
+  deque_struct deque;
+} worker_struct;
+
+typedef struct pool_struct {
+  ulapi_integer count;
+  worker_struct *workers;
+  pthread_mutex_t mutex;
+  pthread_cond_t work;
+  volatile int pending;		/* queued and not yet taken */
+  volatile int sleepers;	/* workers waiting on 'work' */
+  volatile unsigned int next;	/* worker for the next outside job */
+  ulapi_flag stopping;
+} pool_struct;
+
+#define DEQUE_INITIAL_SIZE 64
+
+/* the worker the calling thread is, if any */
+static __thread worker_struct *pool_self = NULL;
+
+static ulapi_result deque_init(deque_struct *d)
+{
+  d->jobs = (job_struct **) malloc(DEQUE_INITIAL_SIZE * sizeof(job_struct *));
+  if (NULL == d->jobs) return ULAPI_ERROR;
+  d->size = DEQUE_INITIAL_SIZE;
+  d->top = d->bottom = 0;
+  pthread_mutex_init(&d->mutex, NULL);
+
+  return ULAPI_OK;
+}
+
+static ulapi_result deque_push(deque_struct *d, job_struct *job)
+{
+  job_struct **jobs;
+  unsigned int i;
+
+  pthread_mutex_lock(&d->mutex);
+
+  if (d->bottom - d->top == d->size) {
+    /* full, so double it, unwrapping the ring as it's copied */
+    jobs = (job_struct **) malloc(2 * d->size * sizeof(job_struct *));
+    if (NULL == jobs) {
+      pthread_mutex_unlock(&d->mutex);
+      return ULAPI_ERROR;
+    }
+    for (i = 0; i < d->size; i++) jobs[i] = d->jobs[(d->top + i) & (d->size - 1)];
+    free(d->jobs);
+    d->jobs = jobs;
+    __atomic_store_n(&d->top, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, d->size, __ATOMIC_RELAXED);
+    d->size *= 2;
+  }
+
+  d->jobs[d->bottom & (d->size - 1)] = job;
+  __atomic_store_n(&d->bottom, d->bottom + 1, __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock(&d->mutex);
+
+  return ULAPI_OK;
+}
+
+static job_struct *deque_pop(deque_struct *d)
+{
+  job_struct *job = NULL;
+
+  pthread_mutex_lock(&d->mutex);
+  if (d->bottom != d->top) {
+    __atomic_store_n(&d->bottom, d->bottom - 1, __ATOMIC_RELAXED);
+    job = d->jobs[d->bottom & (d->size - 1)];
+  }
+  pthread_mutex_unlock(&d->mutex);
+
+  return job;
+}
+
+static job_struct *deque_steal(deque_struct *d)
+{
+  job_struct *job = NULL;
+
+  /*
+    Not worth waiting for, as there are other queues to try. A stale
+    look only costs a wasted lock, or a job left for the next pass.
+  */
+  if (__atomic_load_n(&d->bottom, __ATOMIC_RELAXED) ==
+      __atomic_load_n(&d->top, __ATOMIC_RELAXED)) return NULL;
+
+  pthread_mutex_lock(&d->mutex);
+  if (d->bottom != d->top) {
+    job = d->jobs[d->top & (d->size - 1)];
+    __atomic_store_n(&d->top, d->top + 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&d->mutex);
+
+  return job;
+}
+
+/* takes a job from worker 'index', or failing that from another */
+static job_struct *pool_take(pool_struct *pool, ulapi_integer index)
+{
+  job_struct *job;
+  ulapi_integer i;
+
+  if (0 == __atomic_load_n(&pool->pending, __ATOMIC_RELAXED)) return NULL;
+
+  job = deque_pop(&pool->workers[index].deque);
+  for (i = 1; NULL == job && i < pool->count; i++) {
+    job = deque_steal(&pool->workers[(index + i) % pool->count].deque);
+  }
+
+  if (NULL != job) __sync_fetch_and_sub(&pool->pending, 1);
+
+  return job;
+}
+
+static void job_run(job_struct *job)
+{
+  group_struct *group = job->group;
+
+  job->code(job->arg);
+  free(job);
+
+  if (NULL != group) {
+    /* under the mutex, so the waiter can't delete the group under us */
+    pthread_mutex_lock(&group->mutex);
+    if (0 == --group->count) pthread_cond_broadcast(&group->done);
+    pthread_mutex_unlock(&group->mutex);
+  }
+}
+
+static void worker_code(void *arg)
+{
+  worker_struct *self = (worker_struct *) arg;
+  pool_struct *pool = self->pool;
+  job_struct *job;
+  ulapi_flag stop;
+
+  pool_self = self;
+
+  for (;;) {
+    job = pool_take(pool, self->index);
+    if (NULL != job) {
+      job_run(job);
+      continue;
+    }
+
+    /*
+      Counting ourselves as a sleeper before looking at 'pending' for
+      the last time, while submitters count the job before looking at
+      'sleepers', means one or the other sees it, so no wakeup is lost.
+    */
+    pthread_mutex_lock(&pool->mutex);
+    __sync_fetch_and_add(&pool->sleepers, 1);
+    while (0 == __sync_fetch_and_add(&pool->pending, 0) && ! pool->stopping) {
+      pthread_cond_wait(&pool->work, &pool->mutex);
+    }
+    __sync_fetch_and_sub(&pool->sleepers, 1);
+    stop = pool->stopping && 0 == __atomic_load_n(&pool->pending, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (stop) break;
+  }
+}
+
+static void pool_free(pool_struct *pool)
+{
+  ulapi_integer i;
+
+  for (i = 0; i < pool->count; i++) {
+    free(pool->workers[i].deque.jobs);
+    if (NULL != pool->workers[i].task) ulapi_task_delete(pool->workers[i].task);
+  }
+  free(pool->workers);
+  free(pool);
+}
+
+static void pool_stop(pool_struct *pool, ulapi_integer started)
+{
+  ulapi_integer i;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i = 0; i < started; i++) {
+    ulapi_task_join(pool->workers[i].task, NULL);
+  }
+}
+
+void *ulapi_pool_new(ulapi_integer workers, ulapi_prio prio, const char *cpus)
+{
+  pool_struct *pool;
+  worker_struct *w;
+  ulapi_integer i;
+
+  if (workers <= 0) return NULL;
+
+  pool = (pool_struct *) calloc(1, sizeof(pool_struct));
+  if (NULL == pool) return NULL;
+  pool->workers = (worker_struct *) calloc(workers, sizeof(worker_struct));
+  if (NULL == pool->workers) {
+    free(pool);
+    return NULL;
+  }
+  pool->count = workers;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work, NULL);
+
+  for (i = 0; i < workers; i++) {
+    w = &pool->workers[i];
+    w->pool = pool;
+    w->index = i;
+    w->task = ulapi_task_new();
+    if (NULL == w->task || ULAPI_OK != deque_init(&w->deque)) break;
+    if (NULL != cpus && ULAPI_OK != ulapi_task_set_cpus(w->task, cpus)) break;
+    if (ULAPI_OK != ulapi_task_start(w->task, worker_code, w, prio, 0)) break;
+  }
+
+  if (i < workers) {
+    pool_stop(pool, i);
+    pool_free(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+ulapi_result ulapi_pool_delete(void *pool)
+{
+  pool_struct *p = (pool_struct *) pool;
+
+  if (NULL == p) return ULAPI_OK;
+  /* a worker would be waiting for itself */
+  if (NULL != pool_self && pool_self->pool == p) return ULAPI_ERROR;
+
+  /* the workers finish what's queued first */
+  pool_stop(p, p->count);
+  pool_free(p);
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_pool_submit(void *pool, void *group, void (*code)(void *), void *arg)
+{
+  pool_struct *p = (pool_struct *) pool;
+  group_struct *g = (group_struct *) group;
+  job_struct *job;
+  ulapi_integer index;
+
+  if (NULL == p || NULL == code) return ULAPI_BAD_ARGS;
+
+  job = (job_struct *) malloc(sizeof(job_struct));
+  if (NULL == job) return ULAPI_ERROR;
+  job->code = code;
+  job->arg = arg;
+  job->group = g;
+
+  if (NULL != g) {
+    pthread_mutex_lock(&g->mutex);
+    g->count++;
+    pthread_mutex_unlock(&g->mutex);
+  }
+
+  if (NULL != pool_self && pool_self->pool == p) {
+    index = pool_self->index;
+  } else {
+    index = (ulapi_integer) (__sync_fetch_and_add(&p->next, 1) % p->count);
+  }
+
+  if (ULAPI_OK != deque_push(&p->workers[index].deque, job)) {
+    if (NULL != g) {
+      pthread_mutex_lock(&g->mutex);
+      if (0 == --g->count) pthread_cond_broadcast(&g->done);
+      pthread_mutex_unlock(&g->mutex);
+    }
+    free(job);
+    return ULAPI_ERROR;
+  }
+
+  __sync_fetch_and_add(&p->pending, 1);
+  if (0 != __sync_fetch_and_add(&p->sleepers, 0)) {
+    pthread_mutex_lock(&p->mutex);
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->mutex);
+  }
+
+  return ULAPI_OK;
+}
+
+void *ulapi_pool_group_new(void)
+{
+  group_struct *g;
+
+  g = (group_struct *) calloc(1, sizeof(group_struct));
+  if (NULL == g) return NULL;
+
+  pthread_mutex_init(&g->mutex, NULL);
+  pthread_cond_init(&g->done, NULL);
+
+  return g;
+}
+
+ulapi_result ulapi_pool_group_wait(void *pool, void *group)
+{
+  pool_struct *p = (pool_struct *) pool;
+  group_struct *g = (group_struct *) group;
+  job_struct *job;
+
+  if (NULL == p || NULL == g) return ULAPI_BAD_ARGS;
+
+  pthread_mutex_lock(&g->mutex);
+  while (0 != g->count) {
+    if (NULL != pool_self && pool_self->pool == p) {
+      /* a worker runs jobs while it waits, or the pool could stall */
+      pthread_mutex_unlock(&g->mutex);
+      job = pool_take(p, pool_self->index);
+      if (NULL != job) job_run(job);
+      pthread_mutex_lock(&g->mutex);
+      if (NULL != job) continue;
+      if (0 == g->count) break;
+    }
+    pthread_cond_wait(&g->done, &g->mutex);
+  }
+  pthread_mutex_unlock(&g->mutex);
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_pool_group_delete(void *group)
+{
+  group_struct *g = (group_struct *) group;
+
+  if (NULL == g) return ULAPI_OK;
+
+  pthread_mutex_destroy(&g->mutex);
+  pthread_cond_destroy(&g->done);
+  free(g);
+
+  return ULAPI_OK;
+}
@@ -0,0 +1,143 @@
+/*!
+  \file ultasks.c
+
+  \brief Lists the tasks a process has exported with
+  ulapi_task_registry_export, without stopping it. With -i, also shows
+  each task's share of a CPU over that many seconds.
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ulapi.h"
+
+static const char *state_name(ulapi_integer state)
+{
+  switch (state) {
+  case ULAPI_TASK_NEW: return "new";
+  case ULAPI_TASK_RUNNING: return "running";
+  case ULAPI_TASK_WAITING: return "waiting";
+  case ULAPI_TASK_PAUSED: return "paused";
+  case ULAPI_TASK_DONE: return "done";
+  }
+  return "?";
+}
+
+/* copies out a consistent snapshot, retrying while it's being written */
+static int snapshot(ulapi_task_registry *reg, ulapi_task_registry *copy)
+{
+  ulapi_integer seq;
+  int tries;
+
+  for (tries = 0; tries < 1000; tries++) {
+    seq = reg->seq;
+    if (seq & 1) {
+      ulapi_sleep(0.001);
+      continue;
+    }
+    /* pairs with the writer's barriers, so the copy is of this seq */
+    __sync_synchronize();
+    memcpy(copy, reg, sizeof(*copy));
+    __sync_synchronize();
+    if (seq == reg->seq) return ULAPI_TASK_REGISTRY_MAGIC == copy->magic;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int option;
+  ulapi_id key = ULAPI_TASK_REGISTRY_KEY;
+  double interval = 0.0;
+  void *shm;
+  ulapi_task_registry *reg;
+  ulapi_task_registry *now, *then;
+  ulapi_task_info *t;
+  ulapi_int64 dt;
+  double percent;
+  int i, j;
+
+  ulapi_opterr = 0;
+
+  for (;;) {
+    option = ulapi_getopt(argc, argv, ":k:i:");
+    if (option == -1)
+      break;
+
+    switch (option) {
+    case 'k':
+      key = strtol(ulapi_optarg, NULL, 0);
+      break;
+
+    case 'i':
+      interval = atof(ulapi_optarg);
+      break;
+
+    case ':':
+      fprintf(stderr, "missing value for -%c\n", ulapi_optopt);
+      return 1;
+      break;
+
+    default:			/* '?' */
+      fprintf(stderr, "unrecognized option -%c\n", ulapi_optopt);
+      return 1;
+      break;
+    }
+  }
+  if (ulapi_optind < argc) {
+    fprintf(stderr, "extra non-option characters: %s\n", argv[ulapi_optind]);
+    return 1;
+  }
+
+  if (ULAPI_OK != ulapi_init()) {
+    fprintf(stderr, "ulapi_init error\n");
+    return 1;
+  }
+
+  /* only to one that's there, so as not to leave an empty one behind */
+  shm = ulapi_shm_attach(key, sizeof(ulapi_task_registry));
+  if (NULL == shm) {
+    fprintf(stderr, "no tasks exported at key 0x%lX\n", (long) key);
+    return 1;
+  }
+  reg = (ulapi_task_registry *) ulapi_shm_addr(shm);
+
+  now = malloc(sizeof(ulapi_task_registry));
+  then = malloc(sizeof(ulapi_task_registry));
+  if (NULL == now || NULL == then) return 1;
+
+  if (! snapshot(reg, then)) {
+    fprintf(stderr, "no tasks exported at key 0x%lX\n", (long) key);
+    return 1;
+  }
+  if (interval > 0.0) {
+    ulapi_sleep(interval);
+    if (! snapshot(reg, now)) return 1;
+  } else {
+    memcpy(now, then, sizeof(*now));
+  }
+
+  printf("process %d, %d tasks\n", (int) now->pid, (int) now->count);
+  printf("%7s %-20s %4s %10s %3s %-8s %10s %10s %6s %8s\n",
+	 "TID", "NAME", "PRIO", "PERIOD_US", "CPU", "STATE", "CYCLES", "CPU_MS", "%CPU", "OVERRUNS");
+  for (i = 0; i < now->count; i++) {
+    t = &now->tasks[i];
+    percent = 0.0;
+    dt = now->updated_ns - then->updated_ns;
+    for (j = 0; dt > 0 && j < then->count; j++) {
+      if (then->tasks[j].os_tid == t->os_tid) {
+	percent = 100.0 * (t->cpu_ns - then->tasks[j].cpu_ns) / dt;
+	break;
+      }
+    }
+    printf("%7d %-20.20s %4d %10d %3d %-8s %10lld %10.1f %6.1f %8lld\n",
+	   (int) t->os_tid, t->name[0] ? t->name : "-", (int) t->prio,
+	   (int) (t->period_nsec / 1000), (int) t->cpu, state_name(t->state),
+	   (long long) t->cycles, t->cpu_ns * 1.0e-6, percent,
+	   (long long) t->overruns);
+  }
+
+  return 0;
+}
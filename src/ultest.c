@@ -18,6 +18,8 @@ static ulapi_integer count;
 
 enum {SHM_SIZE = 1024};
 
+enum {RESTART_PERIOD = 1000000};	/* one millisecond */
+
 typedef struct {
   char array[SHM_SIZE];
 } shm_struct;
@@ -297,6 +299,298 @@ static ulapi_result test_process(void)
   return retval;
 }
 
+static void restart_code(void *args)
+{
+  ulapi_int64 t0;
+
+  (void) args;
+
+  for (;;) {
+    /* some work, so each cycle takes CPU time */
+    t0 = ulapi_time_ns();
+    while (ulapi_time_ns() - t0 < 100000) ;
+    ulapi_wait(RESTART_PERIOD);
+  }
+}
+
+/*
+  A restarted task should measure its new run only, not carry over
+  the old one's last wakeup or statistics.
+*/
+static ulapi_result test_task_restart(void)
+{
+  ulapi_task_struct *task;
+  ulapi_int64 min, mean, max;
+  ulapi_int64 cycles;
+  ulapi_result retval = ULAPI_OK;
+
+  task = ulapi_task_new();
+  if (NULL == task) return ULAPI_ERROR;
+
+  if (ULAPI_OK != ulapi_task_histograms(task, 1) ||
+      ULAPI_OK != ulapi_task_start(task, restart_code, NULL, ulapi_prio_lowest(), RESTART_PERIOD)) {
+    ulapi_task_delete(task);
+    return ULAPI_ERROR;
+  }
+  ulapi_wait(50 * RESTART_PERIOD);
+
+  if (ULAPI_OK != ulapi_task_restart(task, 1000000000)) {
+    ulapi_task_delete(task);
+    return ULAPI_ERROR;
+  }
+  ulapi_wait(20 * RESTART_PERIOD);
+
+  cycles = task->cycles;
+  ulapi_task_cpu_stats(task, &min, &mean, &max, NULL);
+  if (cycles <= 0 || cycles > 30) {
+    ulapi_print("ultest restart: %lld cycles in 20 periods\n", (long long) cycles);
+    retval = ULAPI_ERROR;
+  }
+  if (min < 0 || min > mean || mean > max || max > RESTART_PERIOD * 20) {
+    ulapi_print("ultest restart: CPU min %lld mean %lld max %lld\n",
+		(long long) min, (long long) mean, (long long) max);
+    retval = ULAPI_ERROR;
+  }
+  if (ulapi_histogram_count(ulapi_task_exec_histogram(task)) > cycles ||
+      ulapi_histogram_min(ulapi_task_exec_histogram(task)) < 0 ||
+      ulapi_histogram_max(ulapi_task_exec_histogram(task)) > RESTART_PERIOD * 20) {
+    ulapi_print("ultest restart: exec histogram min %lld max %lld\n",
+		(long long) ulapi_histogram_min(ulapi_task_exec_histogram(task)),
+		(long long) ulapi_histogram_max(ulapi_task_exec_histogram(task)));
+    retval = ULAPI_ERROR;
+  }
+
+  ulapi_task_stop(task);
+  ulapi_task_join(task, NULL);
+  ulapi_task_delete(task);
+
+  return retval;
+}
+
+typedef struct {
+  void *timer;
+  ulapi_int64 due_ns;		/* the earliest it may run next */
+  ulapi_int64 period_ns;
+  ulapi_integer runs;
+  ulapi_integer early;		/* runs before it was due */
+  ulapi_integer delete_after;	/* runs after which it deletes itself, or 0 */
+} timer_test_struct;
+
+static void timer_code(void *arg)
+{
+  timer_test_struct *tt = (timer_test_struct *) arg;
+
+  if (ulapi_time_ns() < tt->due_ns) tt->early++;
+  tt->runs++;
+  tt->due_ns += tt->period_ns;
+
+  if (tt->runs == tt->delete_after) ulapi_timer_delete(tt->timer);
+}
+
+static ulapi_result timer_test_arm(timer_test_struct *tt, ulapi_int64 delay_ns, ulapi_int64 period_ns, ulapi_integer delete_after)
+{
+  tt->due_ns = ulapi_time_ns() + delay_ns;
+  tt->period_ns = period_ns;
+  tt->runs = 0;
+  tt->early = 0;
+  tt->delete_after = delete_after;
+
+  tt->timer = ulapi_timer_new(timer_code, tt);
+  if (NULL == tt->timer) return ULAPI_ERROR;
+
+  return ulapi_timer_arm(tt->timer, delay_ns, period_ns);
+}
+
+/*
+  Timers due past the first 256 ticks start out in the wheel's second
+  level, so these check the cascade down from it as well as periodic
+  re-arming and a timer deleting itself.
+*/
+static ulapi_result test_timer(void)
+{
+  enum {SHORT, LONG, PERIODIC, SELF_DELETE, TIMERS};
+  timer_test_struct tt[TIMERS];
+  ulapi_int64 start, elapsed;
+  ulapi_integer most;
+  ulapi_result retval = ULAPI_OK;
+  int i;
+
+  start = ulapi_time_ns();
+  if (ULAPI_OK != timer_test_arm(&tt[SHORT], 10000000, 0, 0) ||
+      ULAPI_OK != timer_test_arm(&tt[LONG], 300000000, 0, 0) ||
+      ULAPI_OK != timer_test_arm(&tt[PERIODIC], 250000000, 20000000, 0) ||
+      ULAPI_OK != timer_test_arm(&tt[SELF_DELETE], 5000000, 5000000, 3)) {
+    return ULAPI_ERROR;
+  }
+
+  ulapi_wait(600000000);
+
+  /* which waits for any running, so what they've counted can be read */
+  elapsed = ulapi_time_ns() - start;
+  for (i = 0; i < SELF_DELETE; i++) ulapi_timer_delete(tt[i].timer);
+
+  for (i = 0; i < TIMERS; i++) {
+    if (tt[i].early > 0) {
+      ulapi_print("ultest timer %d ran %d times early\n", i, (int) tt[i].early);
+      retval = ULAPI_ERROR;
+    }
+  }
+  if (1 != tt[SHORT].runs || 1 != tt[LONG].runs) {
+    ulapi_print("ultest timer one-shots ran %d and %d times\n", (int) tt[SHORT].runs, (int) tt[LONG].runs);
+    retval = ULAPI_ERROR;
+  }
+  /* as many releases as fit before it was deleted, less a couple it may be late for */
+  most = (ulapi_integer) ((elapsed - 250000000) / 20000000 + 1);
+  if (tt[PERIODIC].runs > most || tt[PERIODIC].runs < most - 2) {
+    ulapi_print("ultest timer periodic ran %d times, not %d\n", (int) tt[PERIODIC].runs, (int) most);
+    retval = ULAPI_ERROR;
+  }
+  if (3 != tt[SELF_DELETE].runs) {
+    ulapi_print("ultest timer deleting itself ran %d times\n", (int) tt[SELF_DELETE].runs);
+    retval = ULAPI_ERROR;
+  }
+
+  return retval;
+}
+
+enum {POOL_JOBS = 200};
+
+typedef struct {
+  void *pool;
+  void *group;
+  int runs[POOL_JOBS];
+  ulapi_flag all_run;		/* all had run when the worker's wait returned */
+} pool_test_struct;
+
+typedef struct {
+  pool_test_struct *pt;
+  int index;
+} pool_job_struct;
+
+static pool_job_struct pool_jobs[POOL_JOBS];
+
+static void pool_job_code(void *arg)
+{
+  pool_job_struct *job = (pool_job_struct *) arg;
+
+  __sync_fetch_and_add(&job->pt->runs[job->index], 1);
+}
+
+/* submits the second half of the jobs from inside the pool, and waits for them all */
+static void pool_parent_code(void *arg)
+{
+  pool_test_struct *pt = (pool_test_struct *) arg;
+  int i;
+
+  for (i = POOL_JOBS / 2; i < POOL_JOBS; i++) {
+    ulapi_pool_submit(pt->pool, pt->group, pool_job_code, &pool_jobs[i]);
+  }
+
+  ulapi_pool_group_wait(pt->pool, pt->group);
+
+  pt->all_run = 1;
+  for (i = 0; i < POOL_JOBS; i++) {
+    if (1 != __sync_fetch_and_add(&pt->runs[i], 0)) pt->all_run = 0;
+  }
+}
+
+/*
+  With one worker, the parent's wait can only finish by running the
+  jobs itself; with more, they're also stolen.
+*/
+static ulapi_result test_pool(ulapi_integer workers)
+{
+  pool_test_struct pt;
+  ulapi_result retval = ULAPI_OK;
+  int i;
+
+  memset(&pt, 0, sizeof(pt));
+  pt.pool = ulapi_pool_new(workers, ulapi_prio_lowest(), NULL);
+  pt.group = ulapi_pool_group_new();
+  if (NULL == pt.pool || NULL == pt.group) return ULAPI_ERROR;
+
+  for (i = 0; i < POOL_JOBS; i++) {
+    pool_jobs[i].pt = &pt;
+    pool_jobs[i].index = i;
+  }
+
+  for (i = 0; i < POOL_JOBS / 2; i++) {
+    ulapi_pool_submit(pt.pool, pt.group, pool_job_code, &pool_jobs[i]);
+  }
+  /* not in the group, since it waits on it */
+  ulapi_pool_submit(pt.pool, NULL, pool_parent_code, &pt);
+
+  ulapi_pool_delete(pt.pool);
+  ulapi_pool_group_delete(pt.group);
+
+  for (i = 0; i < POOL_JOBS; i++) {
+    if (1 != pt.runs[i]) {
+      ulapi_print("ultest pool job %d ran %d times\n", i, pt.runs[i]);
+      retval = ULAPI_ERROR;
+    }
+  }
+  if (! pt.all_run) {
+    ulapi_print("ultest pool group wait returned before its jobs had run\n");
+    retval = ULAPI_ERROR;
+  }
+
+  return retval;
+}
+
+/* whether 'got' is within the histograms' relative error of 'want' */
+static int hist_close(ulapi_int64 got, ulapi_int64 want)
+{
+  return fabs((double) (got - want)) <= 0.03125 * want;
+}
+
+static ulapi_result test_histogram(void)
+{
+  void *hist;
+  ulapi_result retval = ULAPI_OK;
+  int i;
+
+  hist = ulapi_histogram_new();
+  if (NULL == hist) return ULAPI_ERROR;
+
+  /* 1 usec to 1 msec, across many power-of-two ranges */
+  for (i = 1; i <= 1000; i++) ulapi_histogram_record(hist, i * 1000);
+
+  if (1000 != ulapi_histogram_count(hist) ||
+      1000 != ulapi_histogram_min(hist) ||
+      1000000 != ulapi_histogram_max(hist) ||
+      fabs(ulapi_histogram_mean(hist) - 500500) > 1) {
+    ulapi_print("ultest histogram count %lld min %lld max %lld mean %f\n",
+		(long long) ulapi_histogram_count(hist),
+		(long long) ulapi_histogram_min(hist),
+		(long long) ulapi_histogram_max(hist),
+		(double) ulapi_histogram_mean(hist));
+    retval = ULAPI_ERROR;
+  }
+  if (! hist_close(ulapi_histogram_percentile(hist, 50), 500000) ||
+      ! hist_close(ulapi_histogram_percentile(hist, 90), 900000) ||
+      ! hist_close(ulapi_histogram_percentile(hist, 99), 990000)) {
+    ulapi_print("ultest histogram p50 %lld p90 %lld p99 %lld\n",
+		(long long) ulapi_histogram_percentile(hist, 50),
+		(long long) ulapi_histogram_percentile(hist, 90),
+		(long long) ulapi_histogram_percentile(hist, 99));
+    retval = ULAPI_ERROR;
+  }
+
+  /* small values have buckets of their own */
+  ulapi_histogram_reset(hist);
+  if (0 != ulapi_histogram_count(hist)) retval = ULAPI_ERROR;
+  for (i = 0; i < 3; i++) ulapi_histogram_record(hist, 7);
+  if (7 != ulapi_histogram_percentile(hist, 50)) {
+    ulapi_print("ultest histogram of 7s has p50 %lld\n",
+		(long long) ulapi_histogram_percentile(hist, 50));
+    retval = ULAPI_ERROR;
+  }
+
+  ulapi_histogram_delete(hist);
+
+  return retval;
+}
+
 static ulapi_result test_sxprintf(void)
 {
   size_t buffer_size = 1;
@@ -420,6 +714,35 @@ int main(int argc, char *argv[])
   }
   ulapi_print("ultest condition variable test passed\n");
 
+  retval = test_task_restart();
+  if (ULAPI_OK != retval) {
+    ulapi_print("ultest task restart test failed\n");
+    return 1;
+  }
+  ulapi_print("ultest task restart test passed\n");
+
+  retval = test_timer();
+  if (ULAPI_OK != retval) {
+    ulapi_print("ultest software timer test failed\n");
+    return 1;
+  }
+  ulapi_print("ultest software timer test passed\n");
+
+  retval = test_pool(1);
+  if (ULAPI_OK == retval) retval = test_pool(4);
+  if (ULAPI_OK != retval) {
+    ulapi_print("ultest thread pool test failed\n");
+    return 1;
+  }
+  ulapi_print("ultest thread pool test passed\n");
+
+  retval = test_histogram();
+  if (ULAPI_OK != retval) {
+    ulapi_print("ultest histogram test failed\n");
+    return 1;
+  }
+  ulapi_print("ultest histogram test passed\n");
+
   retval = test_fd_stat(NULL);
   if (ULAPI_OK != retval) {
 	  ulapi_print("ultest fd stat test failed on temp file\n");
@@ -0,0 +1,94 @@
+/*!
+  \file ultimebase.c
+
+  \brief A time base shared by processes on one machine, so that their
+  periodic tasks can be released at fixed phases of a common cycle
+  rather than whenever each one happened to start.
+
+  The time base is an epoch and a base period, published in a shared
+  memory segment with a well-known key. The epoch is a ulapi_time_ns
+  time, which is a system-wide monotonic clock, so it means the same
+  thing in every process.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>		/* NULL */
+#include "ulapi.h"
+
+/*
+  Marks the segment as holding a published time base. It differs from
+  ULAPI_TIMEBASE_KEY, so that any other segment there isn't taken for one.
+*/
+#define TIMEBASE_MAGIC 0x54424531
+
+typedef struct {
+  volatile ulapi_integer magic;
+  volatile ulapi_int64 epoch_ns;
+  volatile ulapi_int64 base_period_ns;
+} timebase_struct;
+
+#if defined(__GNUC__)
+#define BARRIER() __sync_synchronize()
+#else
+#define BARRIER()
+#endif
+
+/* attached once and left attached, since other processes use it */
+static void *timebase_shm = NULL;
+
+static timebase_struct *timebase_attach(void)
+{
+  if (NULL == timebase_shm) {
+    timebase_shm = ulapi_shm_new(ULAPI_TIMEBASE_KEY, sizeof(timebase_struct));
+    if (NULL == timebase_shm) return NULL;
+  }
+
+  return (timebase_struct *) ulapi_shm_addr(timebase_shm);
+}
+
+ulapi_result ulapi_timebase_publish(ulapi_int64 base_period_nsec)
+{
+  timebase_struct *tb;
+
+  if (base_period_nsec <= 0) return ULAPI_BAD_ARGS;
+
+  tb = timebase_attach();
+  if (NULL == tb) return ULAPI_ERROR;
+
+  /*
+    A publisher restarting with the same period keeps the epoch, so
+    tasks still running elsewhere stay in phase with its new ones.
+  */
+  if (TIMEBASE_MAGIC == tb->magic && base_period_nsec == tb->base_period_ns) {
+    return ULAPI_OK;
+  }
+
+  /* readers check the magic first, so it's written last */
+  tb->magic = 0;
+  BARRIER();
+  tb->epoch_ns = ulapi_time_ns();
+  tb->base_period_ns = base_period_nsec;
+  BARRIER();
+  tb->magic = TIMEBASE_MAGIC;
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_timebase_get(ulapi_int64 *epoch_nsec, ulapi_int64 *base_period_nsec)
+{
+  timebase_struct *tb;
+
+  tb = timebase_attach();
+  if (NULL == tb) return ULAPI_ERROR;
+
+  if (TIMEBASE_MAGIC != tb->magic) return ULAPI_ERROR;
+  BARRIER();
+
+  if (NULL != epoch_nsec) *epoch_nsec = tb->epoch_ns;
+  if (NULL != base_period_nsec) *base_period_nsec = tb->base_period_ns;
+
+  return ULAPI_OK;
+}
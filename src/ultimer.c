@@ -0,0 +1,406 @@
+/*!
+  \file ultimer.c
+
+  \brief Software timers, many of them run from one service thread.
+
+  Timers are kept in a hierarchical timing wheel, as in the classic
+  Unix kernel timer code: four levels of 256 slots, each level's slot
+  spanning 256 times the one below it. Arming and cancelling are
+  constant time. As time advances, the timers in a higher-level slot
+  are cascaded down into the levels below when their range comes up,
+  and the timers in the current bottom-level slot are run.
+
+  One timerfd wakes the service thread for the next tick that has
+  something to do, rather than every tick, so a few slow timers cost
+  almost nothing when idle.
+
+  The tick is 1 millisecond, and timers never run early. Delays are
+  limited to 2^32 ticks, about 49 days.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>		/* NULL */
+#include <stdlib.h>		/* calloc, free */
+#include <errno.h>		/* EINTR */
+#include <unistd.h>		/* read, close */
+#include <time.h>		/* CLOCK_MONOTONIC */
+#include <pthread.h>
+#include <sys/timerfd.h>	/* timerfd_create, timerfd_settime */
+#include "ulapi.h"
+
+#define TICK_NSEC 1000000
+#define SLOT_BITS 8
+#define SLOT_COUNT (1 << SLOT_BITS)
+#define SLOT_MASK (SLOT_COUNT - 1)
+#define LEVELS 4
+#define MAX_TICKS ((((ulapi_int64) 1) << (SLOT_BITS * LEVELS)) - 1)
+
+typedef struct timer_struct {
+  /* links in a wheel slot, or NULL if not armed */
+  struct timer_struct *next;
+  struct timer_struct *prev;
+  void (*code)(void *);
+  void *arg;
+  ulapi_int64 expires;		/* tick on which it runs */
+  ulapi_int64 period;		/* in ticks, or 0 for one-shot */
+  ulapi_flag dead;		/* deleted while running, so free after */
+} timer_struct;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t done;		/* signalled when a timer's code returns */
+  int fd;			/* the timerfd */
+  pthread_t tid;
+  ulapi_int64 start_ns;		/* time of tick 0 */
+  ulapi_int64 current;		/* the next tick to be run */
+  ulapi_int64 programmed;	/* tick the timerfd is set for, or -1 */
+  ulapi_integer armed;		/* how many timers are in the wheel */
+  timer_struct *running;	/* whose code is running now */
+  /* the slot list heads, linked to themselves when empty */
+  timer_struct wheel[LEVELS][SLOT_COUNT];
+} service_struct;
+
+static service_struct service;
+static pthread_once_t service_once = PTHREAD_ONCE_INIT;
+static ulapi_flag service_ok = 0;
+
+static void list_init(timer_struct *head)
+{
+  head->next = head->prev = head;
+}
+
+static void list_add(timer_struct *head, timer_struct *t)
+{
+  t->next = head;
+  t->prev = head->prev;
+  head->prev->next = t;
+  head->prev = t;
+}
+
+static void list_del(timer_struct *t)
+{
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->next = t->prev = NULL;
+}
+
+/* moves everything in 'from' to the empty list 'to' */
+static void list_splice(timer_struct *from, timer_struct *to)
+{
+  if (from->next == from) return;
+
+  to->next = from->next;
+  to->prev = from->prev;
+  to->next->prev = to;
+  to->prev->next = to;
+  list_init(from);
+}
+
+/* puts 'ns', with respect to the service start, onto a tick, rounding up */
+static ulapi_int64 ns_to_tick(ulapi_int64 ns)
+{
+  ns -= service.start_ns;
+  if (ns <= 0) return 0;
+
+  return (ns + TICK_NSEC - 1) / TICK_NSEC;
+}
+
+static ulapi_int64 tick_now(void)
+{
+  return (ulapi_time_ns() - service.start_ns) / TICK_NSEC;
+}
+
+/* the level is picked by how far off the timer is, the slot by when */
+static void wheel_insert(timer_struct *t)
+{
+  ulapi_int64 delta;
+  int level;
+
+  if (t->expires < service.current) t->expires = service.current;
+  delta = t->expires - service.current;
+
+  for (level = 0; level < LEVELS - 1; level++) {
+    if (delta < (((ulapi_int64) 1) << (SLOT_BITS * (level + 1)))) break;
+  }
+
+  list_add(&service.wheel[level][(t->expires >> (SLOT_BITS * level)) & SLOT_MASK], t);
+}
+
+/* redistributes the slot at 'level' whose range is coming up */
+static int wheel_cascade(int level)
+{
+  timer_struct list;
+  timer_struct *t;
+  int index;
+
+  index = (int) ((service.current >> (SLOT_BITS * level)) & SLOT_MASK);
+
+  list_init(&list);
+  list_splice(&service.wheel[level][index], &list);
+  while (list.next != &list) {
+    t = list.next;
+    list_del(t);
+    wheel_insert(t);
+  }
+
+  return index;
+}
+
+static void service_program(ulapi_int64 tick)
+{
+  struct itimerspec its;
+  ulapi_int64 ns;
+
+  its.it_interval.tv_sec = 0;
+  its.it_interval.tv_nsec = 0;
+
+  if (tick < 0) {
+    /* zero disarms it */
+    its.it_value.tv_sec = 0;
+    its.it_value.tv_nsec = 0;
+  } else {
+    ns = service.start_ns + tick * TICK_NSEC;
+    its.it_value.tv_sec = ns / 1000000000;
+    its.it_value.tv_nsec = ns % 1000000000;
+    /* tick 0 at time 0 would read as disarming */
+    if (0 == its.it_value.tv_sec && 0 == its.it_value.tv_nsec) its.it_value.tv_nsec = 1;
+  }
+
+  (void) timerfd_settime(service.fd, TFD_TIMER_ABSTIME, &its, NULL);
+  service.programmed = tick;
+}
+
+/*
+  Returns the next tick with something to do: the next non-empty slot
+  in this turn of the bottom level, or else the end of the turn, when
+  the levels above are cascaded. Returns -1 if nothing is armed.
+*/
+static ulapi_int64 service_next(void)
+{
+  ulapi_int64 tick;
+
+  if (0 == service.armed) return -1;
+
+  for (tick = service.current; ; tick++) {
+    if (0 == (tick & SLOT_MASK)) return tick;
+    if (service.wheel[0][tick & SLOT_MASK].next != &service.wheel[0][tick & SLOT_MASK]) return tick;
+  }
+}
+
+/* runs the timers due on the current tick, with the mutex held */
+static void service_tick(void)
+{
+  timer_struct list;
+  timer_struct *t;
+  int index;
+  int level;
+
+  index = (int) (service.current & SLOT_MASK);
+  if (0 == index) {
+    for (level = 1; level < LEVELS; level++) {
+      if (0 != wheel_cascade(level)) break;
+    }
+  }
+
+  list_init(&list);
+  list_splice(&service.wheel[0][index], &list);
+  service.current++;
+
+  while (list.next != &list) {
+    t = list.next;
+    list_del(t);
+    if (0 != t->period) {
+      /* keep to the original schedule, skipping any periods missed */
+      t->expires += t->period;
+      if (t->expires < service.current) {
+	t->expires += (service.current - t->expires + t->period - 1) / t->period * t->period;
+      }
+      wheel_insert(t);
+    } else {
+      service.armed--;
+    }
+
+    /* let the code arm, cancel or delete timers, including this one */
+    service.running = t;
+    pthread_mutex_unlock(&service.mutex);
+    t->code(t->arg);
+    pthread_mutex_lock(&service.mutex);
+    service.running = NULL;
+    if (t->dead) free(t);
+    pthread_cond_broadcast(&service.done);
+  }
+}
+
+static void *service_code(void *arg)
+{
+  unsigned long long expirations;
+  ulapi_int64 now;
+  ulapi_int64 next;
+
+  (void) arg;
+
+  for (;;) {
+    if ((ssize_t) sizeof(expirations) != read(service.fd, &expirations, sizeof(expirations))) {
+      if (EINTR == errno || EAGAIN == errno) continue;
+      break;
+    }
+
+    pthread_mutex_lock(&service.mutex);
+    for (now = tick_now(); service.current <= now; ) {
+      service_tick();
+      /* skip over ticks with nothing to do, but not past a cascade */
+      if (service.current <= now) {
+	next = service_next();
+	if (next < 0 || next > now) service.current = now + 1;
+	else service.current = next;
+      }
+    }
+    service_program(service_next());
+    pthread_mutex_unlock(&service.mutex);
+  }
+
+  return NULL;
+}
+
+static void service_start(void)
+{
+  pthread_attr_t attr;
+  int level, slot;
+
+  for (level = 0; level < LEVELS; level++) {
+    for (slot = 0; slot < SLOT_COUNT; slot++) {
+      list_init(&service.wheel[level][slot]);
+    }
+  }
+
+  pthread_mutex_init(&service.mutex, NULL);
+  pthread_cond_init(&service.done, NULL);
+  service.start_ns = ulapi_time_ns();
+  service.current = 0;
+  service.programmed = -1;
+  service.armed = 0;
+  service.running = NULL;
+
+  service.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (service.fd < 0) return;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (0 == pthread_create(&service.tid, &attr, service_code, NULL)) {
+    service_ok = 1;
+  } else {
+    close(service.fd);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+void *ulapi_timer_new(void (*code)(void *arg), void *arg)
+{
+  timer_struct *t;
+
+  if (NULL == code) return NULL;
+
+#ifdef ULAPI_SIM
+  /* the service sleeps on a real clock, so can't follow virtual time */
+  return NULL;
+#endif
+
+  (void) pthread_once(&service_once, service_start);
+  if (! service_ok) return NULL;
+
+  t = (timer_struct *) calloc(1, sizeof(timer_struct));
+  if (NULL == t) return NULL;
+
+  t->code = code;
+  t->arg = arg;
+
+  return t;
+}
+
+/* with the mutex held */
+static void timer_unlink(timer_struct *t)
+{
+  if (NULL != t->next) {
+    list_del(t);
+    service.armed--;
+  }
+}
+
+ulapi_result ulapi_timer_arm(void *timer, ulapi_int64 delay_nsec, ulapi_int64 period_nsec)
+{
+  timer_struct *t = (timer_struct *) timer;
+  ulapi_int64 now;
+  ulapi_int64 ticks;
+
+  if (NULL == t || delay_nsec < 0 || period_nsec < 0) return ULAPI_BAD_ARGS;
+
+  now = ulapi_time_ns();
+
+  pthread_mutex_lock(&service.mutex);
+
+  timer_unlink(t);
+
+  t->expires = ns_to_tick(now + delay_nsec);
+  if (t->expires - service.current > MAX_TICKS) t->expires = service.current + MAX_TICKS;
+
+  ticks = (period_nsec + TICK_NSEC - 1) / TICK_NSEC;
+  if (ticks > MAX_TICKS) ticks = MAX_TICKS;
+  t->period = ticks;
+
+  wheel_insert(t);
+  service.armed++;
+
+  /* wake the service sooner if this one is due before what it's waiting for */
+  if (service.programmed < 0 || t->expires < service.programmed) {
+    service_program(t->expires);
+  }
+
+  pthread_mutex_unlock(&service.mutex);
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_timer_cancel(void *timer)
+{
+  timer_struct *t = (timer_struct *) timer;
+
+  if (NULL == t) return ULAPI_BAD_ARGS;
+
+  pthread_mutex_lock(&service.mutex);
+  timer_unlink(t);
+  pthread_mutex_unlock(&service.mutex);
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_timer_delete(void *timer)
+{
+  timer_struct *t = (timer_struct *) timer;
+
+  if (NULL == t) return ULAPI_OK;
+
+  pthread_mutex_lock(&service.mutex);
+
+  timer_unlink(t);
+
+  if (service.running == t) {
+    if (pthread_equal(pthread_self(), service.tid)) {
+      /* deleting itself from its own code, so free it when that returns */
+      t->dead = 1;
+      pthread_mutex_unlock(&service.mutex);
+      return ULAPI_OK;
+    }
+    while (service.running == t) {
+      pthread_cond_wait(&service.done, &service.mutex);
+    }
+  }
+
+  pthread_mutex_unlock(&service.mutex);
+
+  free(t);
+
+  return ULAPI_OK;
+}
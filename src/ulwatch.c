@@ -0,0 +1,204 @@
+/*!
+  \file ulwatch.c
+
+  \brief A watchdog for tasks. Each watched task pets its watch every
+  cycle with a label saying where it is, and a monitor task checks
+  that none has gone longer than its deadline without, whether it's
+  blocked on a mutex or a read, spinning, or starved of the CPU.
+
+  Petting is only a couple of stores, so it's cheap enough to do in
+  every cycle, or at several points in one. A watch that's missed its
+  deadline is reported once, with its last label and how long ago it
+  was petted, and isn't reported again until it's been petted since.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>		/* fprintf, stderr */
+#include <stddef.h>		/* NULL */
+#include <stdlib.h>		/* calloc, free */
+#include <string.h>		/* strncpy */
+#include "ulapi.h"
+
+typedef struct watch_struct {
+  struct watch_struct *next;
+  char name[ULAPI_TASK_NAME_LEN];
+  ulapi_task_struct *task;	/* to stop or restart, or NULL */
+  ulapi_int64 deadline_ns;
+  ulapi_integer (*escalate)(void *watch, const char *name, const char *label, ulapi_int64 late_nsec, void *arg);
+  void *arg;
+  const char *volatile label;	/* where it was last petted */
+  volatile ulapi_int64 pet_ns;	/* and when */
+  volatile ulapi_flag fired;	/* reported since then */
+} watch_struct;
+
+/* the list is shared with the monitor, and guarded by the mutex */
+static ulapi_mutex_struct *watch_mutex = NULL;
+static watch_struct *watch_head = NULL;
+static ulapi_task_struct *watch_task = NULL;
+static ulapi_integer watch_period_nsec = 0;
+
+static ulapi_result watch_mutex_make(void)
+{
+  /* the first call is expected before there are tasks to race with */
+  if (NULL == watch_mutex) watch_mutex = ulapi_mutex_new(0);
+
+  return NULL == watch_mutex ? ULAPI_ERROR : ULAPI_OK;
+}
+
+static void watch_fire(watch_struct *w, ulapi_int64 late)
+{
+  const char *label = w->label;
+  ulapi_integer action;
+
+  w->fired = 1;
+  action = (NULL == w->escalate ? ULAPI_WATCH_LOG :
+	    w->escalate(w, w->name, label, late, w->arg));
+
+  if (ULAPI_WATCH_IGNORE == action) return;
+
+  fprintf(stderr, "ulapi_watchdog: %s stalled, last at %s %lld msec ago%s\n",
+	  w->name, NULL == label ? "(not petted)" : label,
+	  (long long) ((late + w->deadline_ns) / 1000000),
+	  (NULL == w->task || ULAPI_WATCH_LOG == action) ? "" :
+	  ULAPI_WATCH_STOP == action ? ", stopping it" : ", restarting it");
+
+  if (NULL == w->task) return;
+
+  if (ULAPI_WATCH_STOP == action) {
+    (void) ulapi_task_stop(w->task);
+  } else if (ULAPI_WATCH_RESTART == action) {
+    /* given a check period to stop, so the others aren't left unwatched long */
+    if (ULAPI_OK != ulapi_task_restart(w->task, watch_period_nsec)) {
+      fprintf(stderr, "ulapi_watchdog: can't restart %s\n", w->name);
+      return;
+    }
+    /* watched afresh, with a deadline's grace to get going */
+    w->label = NULL;
+    w->pet_ns = ulapi_time_ns();
+    w->fired = 0;
+  }
+}
+
+static void watch_code(void *arg)
+{
+  watch_struct *w;
+  ulapi_int64 now;
+
+  (void) arg;
+
+  for (;;) {
+    ulapi_mutex_take(watch_mutex);
+    now = ulapi_time_ns();
+    for (w = watch_head; NULL != w; w = w->next) {
+      if (! w->fired && now - w->pet_ns > w->deadline_ns) {
+	watch_fire(w, now - w->pet_ns - w->deadline_ns);
+      }
+    }
+    ulapi_mutex_give(watch_mutex);
+
+    ulapi_wait(watch_period_nsec);
+  }
+}
+
+ulapi_result ulapi_watchdog_start(ulapi_integer period_nsec, ulapi_prio prio)
+{
+  if (period_nsec <= 0) return ULAPI_BAD_ARGS;
+  if (NULL != watch_task) return ULAPI_ERROR;
+  if (ULAPI_OK != watch_mutex_make()) return ULAPI_ERROR;
+
+  watch_period_nsec = period_nsec;
+  watch_task = ulapi_task_new();
+  if (NULL == watch_task) return ULAPI_ERROR;
+  (void) ulapi_task_set_name(watch_task, "ulapi_watchdog");
+
+  if (ULAPI_OK != ulapi_task_start(watch_task, watch_code, NULL, prio, period_nsec)) {
+    ulapi_task_delete(watch_task);
+    watch_task = NULL;
+    return ULAPI_ERROR;
+  }
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_watchdog_stop(void)
+{
+  if (NULL == watch_task) return ULAPI_OK;
+
+  ulapi_task_stop(watch_task);
+  ulapi_task_join(watch_task, NULL);
+  ulapi_task_delete(watch_task);
+  watch_task = NULL;
+
+  return ULAPI_OK;
+}
+
+void *ulapi_watch_new(ulapi_task_struct *task, const char *name, ulapi_int64 deadline_nsec, ulapi_integer (*escalate)(void *watch, const char *name, const char *label, ulapi_int64 late_nsec, void *arg), void *arg)
+{
+  watch_struct *w;
+
+  if (deadline_nsec <= 0) return NULL;
+  if (ULAPI_OK != watch_mutex_make()) return NULL;
+
+  w = (watch_struct *) calloc(1, sizeof(watch_struct));
+  if (NULL == w) return NULL;
+
+  strncpy(w->name, NULL == name ? "a task" : name, sizeof(w->name) - 1);
+  w->task = task;
+  w->deadline_ns = deadline_nsec;
+  w->escalate = escalate;
+  w->arg = arg;
+  /* watched from now, so it has a deadline to be petted first */
+  w->pet_ns = ulapi_time_ns();
+
+  ulapi_mutex_take(watch_mutex);
+  w->next = watch_head;
+  watch_head = w;
+  ulapi_mutex_give(watch_mutex);
+
+  return w;
+}
+
+ulapi_result ulapi_watch_delete(void *watch)
+{
+  watch_struct *w = (watch_struct *) watch;
+  watch_struct **pp;
+
+  if (NULL == w) return ULAPI_OK;
+
+  ulapi_mutex_take(watch_mutex);
+  for (pp = &watch_head; NULL != *pp; pp = &(*pp)->next) {
+    if (*pp == w) {
+      *pp = w->next;
+      break;
+    }
+  }
+  ulapi_mutex_give(watch_mutex);
+
+  free(w);
+
+  return ULAPI_OK;
+}
+
+void ulapi_watch_pet(void *watch, const char *label)
+{
+  watch_struct *w = (watch_struct *) watch;
+
+  w->label = label;
+  w->pet_ns = ulapi_time_ns();
+  w->fired = 0;
+}
+
+ulapi_result ulapi_watch_last(void *watch, const char **label, ulapi_int64 *pet_ns)
+{
+  watch_struct *w = (watch_struct *) watch;
+
+  if (NULL == w) return ULAPI_BAD_ARGS;
+
+  if (NULL != label) *label = w->label;
+  if (NULL != pet_ns) *pet_ns = w->pet_ns;
+
+  return ULAPI_OK;
+}
@@ -69,42 +69,8 @@ rtapi_result rtapi_system(const char *prog, rtapi_integer *result)
   return RTAPI_ERROR;
 }
 
-static rtapi_integer _rtapi_wait_offset_nsec = 0;
-
 static int _do_io = 0;	  /* non-zero means we can access I/O ports */
 
-/*
-  Returns abs val of end - start, as struct timeval
-*/
-static struct timeval timerdiff(struct timeval end, struct timeval start)
-{
-  struct timeval diff;
-
-  if (end.tv_usec < start.tv_usec) {
-    if (end.tv_sec < start.tv_sec) {
-      /* 1.1 - 9.9 */
-      diff.tv_usec = start.tv_usec - end.tv_usec;
-      diff.tv_sec = start.tv_sec - end.tv_sec;
-    } else {
-      /* 9.1 - 1.9 */
-      diff.tv_usec = 1000000 - start.tv_usec + end.tv_usec;
-      diff.tv_sec = end.tv_sec - start.tv_sec - 1;
-    }
-  } else {
-    if (end.tv_sec < start.tv_sec) {
-      /* 1.9 - 9.1 */
-      diff.tv_usec = 1000000 - end.tv_usec + start.tv_usec;
-      diff.tv_sec = start.tv_sec - end.tv_sec - 1;
-    } else {
-      /* 9.9 - 1.1 */
-      diff.tv_usec = end.tv_usec - start.tv_usec;
-      diff.tv_sec = end.tv_sec - start.tv_sec;
-    }
-  }
-
-  return diff;
-}
-
 rtapi_prio rtapi_prio_highest(void)
 {
   return 1;
@@ -143,16 +109,21 @@ rtapi_result rtapi_clock_set_period(rtapi_integer nsecs)
 rtapi_result rtapi_clock_get_time(rtapi_integer * secs, 
 				  rtapi_integer * nsecs)
 {
-  struct timeval tv;
+  rtapi_int64 ns;
 
-  (void) gettimeofday(&tv, NULL);
+  ns = rtapi_clock_get_ns();
 
-  *secs = tv.tv_sec;
-  *nsecs = tv.tv_usec * 1000;
+  *secs = (rtapi_integer) (ns / 1000000000);
+  *nsecs = (rtapi_integer) (ns % 1000000000);
 
   return RTAPI_OK;
 }
 
+rtapi_int64 rtapi_clock_get_ns(void)
+{
+  return ulapi_time_ns();
+}
+
 rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs, 
 				      rtapi_integer start_nsecs,
 				      rtapi_integer end_secs, 
@@ -160,67 +131,43 @@ rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs,
 				      rtapi_integer * diff_secs, 
 				      rtapi_integer * diff_nsecs)
 {
-  if (end_nsecs < start_nsecs) {
-    if (end_secs < start_secs) {
-      /* 1.1 - 9.9 */
-      *diff_nsecs = start_nsecs - end_nsecs;
-      *diff_secs = start_secs - end_secs;
-    } else {
-      /* 9.1 - 1.9 */
-      *diff_nsecs = 1000000000 - start_nsecs + end_nsecs;
-      *diff_secs = end_secs - start_secs - 1;
-    }
-  } else {
-    if (end_secs < start_secs) {
-      /* 1.9 - 9.1 */
-      *diff_nsecs = 1000000000 - end_nsecs + start_nsecs;
-      *diff_secs = start_secs - end_secs - 1;
-    } else {
-      /* 9.9 - 1.1 */
-      *diff_nsecs = end_nsecs - start_nsecs;
-      *diff_secs = end_secs - start_secs;
-    }
-  }
+  rtapi_int64 diff;
+
+  diff = ((rtapi_int64) end_secs - start_secs) * 1000000000 +
+    ((rtapi_int64) end_nsecs - start_nsecs);
+  if (diff < 0) diff = -diff;
+
+  *diff_secs = (rtapi_integer) (diff / 1000000000);
+  *diff_nsecs = (rtapi_integer) (diff % 1000000000);
 
   return RTAPI_OK;
 }
 
+/*
+  Tasks are ULAPI tasks, so that periodic release is handled in one
+  place. See unix_ulapi.c.
+*/
+
 rtapi_result rtapi_task_init(rtapi_task_struct *task)
 {
-  if (0 != pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) return RTAPI_ERROR;
-  if (0 != pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL)) return RTAPI_ERROR;
-
-  return RTAPI_OK;
+  return ULAPI_OK == ulapi_task_init(task) ? RTAPI_OK : RTAPI_ERROR;
 }
 
 rtapi_task_struct *rtapi_task_new(void)
 {
-  rtapi_task_struct *ptr = (rtapi_task_struct *) malloc(sizeof(rtapi_task_struct));
-  if (RTAPI_OK != rtapi_task_init(ptr)) {
-    free(ptr);
-    ptr = NULL;
-  }
-
-  return ptr;
+  return ulapi_task_new();
 }
 
 extern rtapi_result rtapi_task_clear(rtapi_task_struct *task)
 {
-  return RTAPI_OK;
+  return ULAPI_OK == ulapi_task_clear(task) ? RTAPI_OK : RTAPI_ERROR;
 }
 
 rtapi_result rtapi_task_delete(rtapi_task_struct *task)
 {
-  if (NULL != task) {
-    rtapi_task_clear(task);
-    free(task);
-  }
-
-  return RTAPI_OK;
+  return ULAPI_OK == ulapi_task_delete(task) ? RTAPI_OK : RTAPI_ERROR;
 }
 
-typedef void *(*pthread_task_code)(void *);
-
 rtapi_result
 rtapi_task_start(rtapi_task_struct *task,
 		 void (*taskcode)(void *),
@@ -230,58 +177,64 @@ rtapi_task_start(rtapi_task_struct *task,
 		 rtapi_integer period_nsec, 
 		 rtapi_flag uses_fp)
 {
-  pthread_attr_t attr;
-  struct sched_param sched_param;
+  if (stacksize < 0) return RTAPI_BAD_ARGS;
+  if (ULAPI_OK != ulapi_task_set_stacksize(task, (size_t) stacksize)) return RTAPI_ERROR;
 
-  pthread_attr_init(&attr);
-  sched_param.sched_priority = prio;
-  pthread_attr_setschedparam(&attr, &sched_param);
-  pthread_create((pthread_t *) task, &attr, (pthread_task_code) taskcode, taskarg);
-  pthread_setschedparam(*((pthread_t *) task), SCHED_OTHER, &sched_param);
-  /* ignore period_nsec, since we can't handle it in pthreads, so the
-     application must call rtapi_wait(period_nsec) */
-
-  return RTAPI_OK;
+  return ULAPI_OK == ulapi_task_start(task, taskcode, taskarg, prio, period_nsec) ? RTAPI_OK : RTAPI_ERROR;
 }
 
 rtapi_result rtapi_task_stop(rtapi_task_struct *task)
 {
-  return (pthread_cancel(*((pthread_t *) task)) == 0 ? RTAPI_OK : RTAPI_ERROR);
+  return ULAPI_OK == ulapi_task_stop(task) ? RTAPI_OK : RTAPI_ERROR;
 }
 
 rtapi_result rtapi_task_pause(rtapi_task_struct *task)
 {
-  return RTAPI_OK;
+  return ULAPI_OK == ulapi_task_pause(task) ? RTAPI_OK : RTAPI_ERROR;
 }
 
 rtapi_result rtapi_task_resume(rtapi_task_struct *task)
 {
-  return RTAPI_OK;
+  return ULAPI_OK == ulapi_task_resume(task) ? RTAPI_OK : RTAPI_ERROR;
 }
 
 rtapi_result rtapi_task_set_period(rtapi_task_struct *task, rtapi_integer period_nsec)
 {
-  return RTAPI_OK;
+  return ULAPI_OK == ulapi_task_set_period(task, period_nsec) ? RTAPI_OK : RTAPI_ERROR;
 }
 
 rtapi_result rtapi_self_set_period(rtapi_integer period_nsec)
 {
-  return RTAPI_OK;
+  return ULAPI_OK == ulapi_self_set_period(period_nsec) ? RTAPI_OK : RTAPI_ERROR;
 }
 
-rtapi_result rtapi_wait(rtapi_integer period_nsec)
+rtapi_result rtapi_task_set_cpus(rtapi_task_struct *task, const char *cpus)
 {
-  struct timespec ts;
+  return ULAPI_OK == ulapi_task_set_cpus(task, cpus) ? RTAPI_OK : RTAPI_ERROR;
+}
 
-  if (period_nsec < _rtapi_wait_offset_nsec + 1) period_nsec = 1;
-  else period_nsec -= _rtapi_wait_offset_nsec;
+rtapi_result rtapi_task_set_name(rtapi_task_struct *task, const char *name)
+{
+  return ULAPI_OK == ulapi_task_set_name(task, name) ? RTAPI_OK : RTAPI_ERROR;
+}
 
-  ts.tv_sec = 0;
-  ts.tv_nsec = period_nsec;
+rtapi_result rtapi_timebase_publish(rtapi_int64 base_period_nsec)
+{
+  return ULAPI_OK == ulapi_timebase_publish(base_period_nsec) ? RTAPI_OK : RTAPI_ERROR;
+}
 
-  (void) nanosleep(&ts, NULL);
+rtapi_result rtapi_task_set_phase(rtapi_task_struct *task, rtapi_int64 offset_nsec)
+{
+  return ULAPI_OK == ulapi_task_set_phase(task, offset_nsec) ? RTAPI_OK : RTAPI_ERROR;
+}
 
-  return RTAPI_OK;
+rtapi_result rtapi_wait(rtapi_integer period_nsec)
+{
+  /*
+    Periodic tasks ignore the period and wait for their next release.
+    ULAPI accounts for the wakeup overhead of others.
+  */
+  return ULAPI_OK == ulapi_wait(period_nsec) ? RTAPI_OK : RTAPI_ERROR;
 }
 
 rtapi_result rtapi_task_exit(void)
@@ -291,7 +244,12 @@ rtapi_result rtapi_task_exit(void)
 
 rtapi_integer rtapi_task_stack_check(rtapi_task_struct *task)
 {
-  return -1;			/* irrelevant on this platform */
+  return ulapi_task_stack_check(task);
+}
+
+rtapi_integer rtapi_task_overruns(rtapi_task_struct *task)
+{
+  return (rtapi_integer) ulapi_task_overruns(task);
 }
 
 typedef struct {
@@ -559,10 +517,18 @@ char ** rtapi_argv;
 
 rtapi_result rtapi_app_init(int argc, char ** argv)
 {
-  struct timeval start, end, diff;
-  struct timespec ts;
   int t;
 
+  /*
+    Tasks are ULAPI tasks, so set that up too. It picks the scheduling
+    profile, and fails under ULAPI_PROFILE=rt without the privileges
+    for it. The wakeup overhead is learned as tasks run, and saved from
+    run to run, rather than measured here.
+  */
+  if (ULAPI_OK != ulapi_init()) return RTAPI_ERROR;
+  /* here, rather than in the first task to take a timestamp */
+  (void) ulapi_cycles_init();
+
   /* copy argc and argv for use by tasks when they init */
   rtapi_argc = argc;
   rtapi_argv = (char **) malloc(argc * sizeof(char *));
@@ -571,25 +537,6 @@ rtapi_result rtapi_app_init(int argc, char ** argv)
     strcpy(rtapi_argv[t], argv[t]);
   }
 
-  ts.tv_sec = 0;
-  ts.tv_nsec = 1;		/* this will trigger twice the quantum */
-
-#define NUM 100
-
-  gettimeofday(&start, NULL);
-  for (t = 0; t < NUM; t++) {
-    nanosleep(&ts, NULL);
-  }
-  gettimeofday(&end, NULL);
-  diff = timerdiff(end, start);
-
-  /*
-    The subtracted offset to align requested sleeps with actuals,
-    best fit, is 1.5 X quantum, or 0.75 X twice the quantum, which is
-    what we just measured. With usec to nsec give 750 X.
-  */
-  _rtapi_wait_offset_nsec = diff.tv_usec * 750 / NUM;
-
   /* turn on IO permissions */
   _do_io = 0;
 #if HAVE_IOPL
@@ -12,10 +12,16 @@
 #include "config.h"
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* cpu_set_t, pthread_setaffinity_np */
+#endif
+
 #include "ulapi.h"		/* these decls */
+#include "inifile.h"		/* ini_find, ini_has_section */
 #include <stdio.h>
 #include <stddef.h>		/* NULL */
 #include <stdlib.h>		/* malloc */
+#include <limits.h>		/* PTHREAD_STACK_MIN */
 #include <string.h>		/* memset */
 #include <stdarg.h>		/* va_list, va_start */
 #include <signal.h>		/* kill, SIGINT */
@@ -40,6 +46,15 @@
 #include <arpa/inet.h>		/* inet_addr */
 #include <sys/stat.h>		/* struct stat */
 #include <sys/ioctl.h>
+#include <sys/mman.h>		/* mmap, mlock */
+#include <ucontext.h>		/* makecontext, swapcontext */
+#include <sys/resource.h>	/* getrlimit, RLIMIT_RTPRIO */
+#include <sched.h>		/* SCHED_FIFO, sched_get_priority_max */
+#ifdef __linux__
+#include <sys/prctl.h>		/* prctl, PR_SET_TIMERSLACK */
+#include <sys/syscall.h>	/* SYS_futex */
+#include <linux/futex.h>	/* FUTEX_WAIT, FUTEX_WAKE */
+#endif
 #ifndef NO_DL
 #include <dlfcn.h>
 #endif
@@ -95,8 +110,6 @@ int ulapi_strxcat(char **dst, size_t *dst_size, const char *src)
   return 0;
 }
 
-static ulapi_integer _ulapi_wait_offset_nsec = 1;
-
 /*
   'ulapi_time' returns the current time with respect to some arbitrary
   origin that remains constant for the life of the program.
@@ -122,9 +135,205 @@ static ulapi_integer _ulapi_wait_offset_nsec = 1;
   backwards. 
 */
 
+#ifdef ULAPI_SIM
+
+#define SIM_BUILD 1
+
+/*
+  In the simulation build, time is virtual. It stands still while any
+  thread taking part is running, and when they're all asleep in a
+  ULAPI wait or sleep, or blocked joining a task or waiting for the
+  application to end, it jumps to the earliest wakeup. Threads take
+  part from when they're started as tasks, or from their first wait,
+  sleep or task start, until they exit. A thread blocked on anything
+  else, e.g., a semaphore, holds time still, as if it were running.
+*/
+
+/* so that times are never mistaken for unset zeros */
+#define SIM_START_NS 1000000000LL
+
+typedef struct sim_sleeper {
+  struct sim_sleeper *next;
+  ulapi_int64 deadline;
+  volatile int *stop;		/* its task's stop word, or NULL */
+  ulapi_flag due;
+} sim_sleeper;
+
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static ulapi_int64 sim_now = SIM_START_NS;
+static int sim_threads = 0;	/* taking part */
+static int sim_idle = 0;	/* of those, asleep or blocked */
+static sim_sleeper *sim_sleepers = NULL;
+static pthread_key_t sim_key;	/* non-NULL for threads taking part */
+static pthread_once_t sim_key_once = PTHREAD_ONCE_INIT;
+
+/* with the mutex held, if all are idle, jumps to the earliest wakeup */
+static void sim_advance(void)
+{
+  sim_sleeper **pp;
+  sim_sleeper *s;
+  ulapi_int64 next;
+
+  if (sim_idle < sim_threads || NULL == sim_sleepers) return;
+
+  next = sim_sleepers->deadline;
+  for (s = sim_sleepers->next; NULL != s; s = s->next) {
+    if (s->deadline < next) next = s->deadline;
+  }
+  if (next > sim_now) sim_now = next;
+
+  /* the ones woken are running from now, not when they get the mutex */
+  for (pp = &sim_sleepers; NULL != *pp; ) {
+    s = *pp;
+    if (s->deadline <= sim_now) {
+      *pp = s->next;
+      s->due = 1;
+      sim_idle--;
+    } else {
+      pp = &s->next;
+    }
+  }
+
+  pthread_cond_broadcast(&sim_cond);
+}
+
+/* run as the thread exits */
+static void sim_leave(void *ptr)
+{
+  (void) ptr;
+
+  pthread_mutex_lock(&sim_mutex);
+  sim_threads--;
+  sim_advance();
+  pthread_mutex_unlock(&sim_mutex);
+}
+
+static void sim_key_make(void)
+{
+  (void) pthread_key_create(&sim_key, sim_leave);
+}
+
+/* with the mutex held, counts in the calling thread if it isn't already */
+static void sim_take_part(void)
+{
+  (void) pthread_once(&sim_key_once, sim_key_make);
+  if (NULL == pthread_getspecific(sim_key)) {
+    (void) pthread_setspecific(sim_key, (void *) 1);
+    sim_threads++;
+  }
+}
+
+/*
+  Counts in a task about to be started, so time waits for it, and the
+  thread starting it, so that time waits for it to start any others
+  rather than running ahead with the first.
+*/
+static void sim_expect(void)
+{
+  pthread_mutex_lock(&sim_mutex);
+  sim_take_part();
+  sim_threads++;
+  pthread_mutex_unlock(&sim_mutex);
+}
+
+/* in the new task, so that it's counted out when it exits */
+static void sim_arrive(void)
+{
+  (void) pthread_once(&sim_key_once, sim_key_make);
+  (void) pthread_setspecific(sim_key, (void *) 1);
+}
+
+/*
+  Sleeps until virtual time 'deadline', or until '*stop' is set if
+  'stop' isn't NULL. Cancellation is held off so that a killed task
+  can't leave itself on the list.
+*/
+static void sim_sleep_until(ulapi_int64 deadline, volatile int *stop)
+{
+  sim_sleeper self;
+  int state;
+
+  (void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+  pthread_mutex_lock(&sim_mutex);
+
+  sim_take_part();
+
+  if (deadline > sim_now && ! (NULL != stop && *stop)) {
+    self.deadline = deadline;
+    self.stop = stop;
+    self.due = 0;
+    self.next = sim_sleepers;
+    sim_sleepers = &self;
+    sim_idle++;
+    sim_advance();
+    while (! self.due) pthread_cond_wait(&sim_cond, &sim_mutex);
+  }
+
+  pthread_mutex_unlock(&sim_mutex);
+
+  (void) pthread_setcancelstate(state, NULL);
+}
+
+/* wakes a sleeper whose task has been asked to stop, as running from now */
+static void sim_stop(volatile int *stop)
+{
+  sim_sleeper **pp;
+  sim_sleeper *s;
+
+  pthread_mutex_lock(&sim_mutex);
+  for (pp = &sim_sleepers; NULL != *pp; pp = &(*pp)->next) {
+    s = *pp;
+    if (s->stop == stop) {
+      *pp = s->next;
+      s->due = 1;
+      sim_idle--;
+      pthread_cond_broadcast(&sim_cond);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&sim_mutex);
+}
+
+/* marks a thread taking part as blocked, or not, and so not holding time */
+static void sim_block(ulapi_flag blocked)
+{
+  (void) pthread_once(&sim_key_once, sim_key_make);
+  if (NULL == pthread_getspecific(sim_key)) return;
+
+  pthread_mutex_lock(&sim_mutex);
+  if (blocked) {
+    sim_idle++;
+    sim_advance();
+  } else {
+    sim_idle--;
+  }
+  pthread_mutex_unlock(&sim_mutex);
+}
+
+static ulapi_int64 sim_time_ns(void)
+{
+  ulapi_int64 now;
+
+  pthread_mutex_lock(&sim_mutex);
+  now = sim_now;
+  pthread_mutex_unlock(&sim_mutex);
+
+  return now;
+}
+
+#else
+
+#define SIM_BUILD 0
+
+#endif	/* ULAPI_SIM */
+
 ulapi_real ulapi_time(void)
 {
-#ifdef HAVE_CLOCK_GETTIME
+#if defined(ULAPI_SIM)
+  return (ulapi_real) (sim_time_ns() * 1.0e-9);
+#elif defined(HAVE_CLOCK_GETTIME)
 #if defined (CLOCK_MONOTONIC_RT)
   struct timespec ts;
   clock_gettime(CLOCK_MONOTONIC_RT, &ts);
@@ -151,259 +360,2527 @@ ulapi_real ulapi_time(void)
 #endif
 }
 
-const char *ulapi_time_string(char *dst, size_t size)
+ulapi_int64 ulapi_time_ns(void)
+{
+#ifdef ULAPI_SIM
+  return sim_time_ns();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((ulapi_int64) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*
+  The cycle counter is used only if it ticks at a constant rate
+  regardless of power states, and only after ulapi_cycles_init has
+  calibrated it, which isn't done by ulapi_init so that programs that
+  never read it don't wait for it. Until then, ulapi_cycles is
+  ulapi_time_ns and the scale is 1.
+*/
+static int _ulapi_cycles_counter = 0;
+static double _ulapi_ns_per_cycle = 1.0;
+static pthread_once_t cycles_once = PTHREAD_ONCE_INIT;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <cpuid.h>		/* __get_cpuid */
+
+static ulapi_int64 cycles_read(void)
+{
+  unsigned int lo, hi;
+
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+
+  return (((ulapi_int64) hi) << 32) | lo;
+}
+
+/* the invariant TSC bit is CPUID 0x80000007, EDX bit 8 */
+static int cycles_usable(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (0 == __get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx)) return 0;
+  if (eax < 0x80000007) return 0;
+  if (0 == __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return 0;
+
+  return (edx & (1 << 8)) ? 1 : 0;
+}
+
+static double cycles_freq(void)
+{
+  return 0.0;			/* unknown, so calibrate */
+}
+
+/* tells the core we're spinning, saving power and its hyperthread sibling */
+static void cpu_relax(void)
+{
+  __asm__ __volatile__ ("pause" ::: "memory");
+}
+
+#elif defined(__GNUC__) && defined(__aarch64__)
+
+static ulapi_int64 cycles_read(void)
+{
+  ulapi_int64 val;
+
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (val));
+
+  return val;
+}
+
+/* the generic timer's virtual count is architecturally constant-rate */
+static int cycles_usable(void)
+{
+  return 1;
+}
+
+static double cycles_freq(void)
+{
+  ulapi_int64 freq;
+
+  __asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (freq));
+
+  return (double) freq;
+}
+
+static void cpu_relax(void)
+{
+  __asm__ __volatile__ ("yield" ::: "memory");
+}
+
+#else
+
+static ulapi_int64 cycles_read(void)
+{
+  return ulapi_time_ns();
+}
+
+static int cycles_usable(void)
+{
+  return 0;
+}
+
+static double cycles_freq(void)
+{
+  return 0.0;
+}
+
+static void cpu_relax(void)
+{
+  return;
+}
+
+#endif
+
+/*
+  Measures the cycle rate against CLOCK_MONOTONIC over a short sleep.
+  Each end brackets the cycle reading between two clock readings and
+  takes their midpoint.
+*/
+static void cycles_calibrate(void)
+{
+  enum {CALIBRATE_NSEC = 10000000};
+  ulapi_int64 ns0, ns1, c0, c1;
+  struct timespec ts;
+  double freq;
+
+  /* simulations have no real clock to calibrate against */
+  if (SIM_BUILD || ! cycles_usable()) return;
+
+  freq = cycles_freq();
+  if (freq > 0.0) {
+    _ulapi_ns_per_cycle = 1.0e9 / freq;
+    __sync_synchronize();
+    _ulapi_cycles_counter = 1;
+    return;
+  }
+
+  ns0 = ulapi_time_ns();
+  c0 = cycles_read();
+  ns0 = (ns0 + ulapi_time_ns()) / 2;
+
+  ts.tv_sec = 0;
+  ts.tv_nsec = CALIBRATE_NSEC;
+  (void) nanosleep(&ts, NULL);
+
+  ns1 = ulapi_time_ns();
+  c1 = cycles_read();
+  ns1 = (ns1 + ulapi_time_ns()) / 2;
+
+  if (c1 <= c0 || ns1 <= ns0) return;
+
+  _ulapi_ns_per_cycle = ((double) (ns1 - ns0)) / ((double) (c1 - c0));
+  /* the rate before the counter, for readers that see the counter on */
+  __sync_synchronize();
+  _ulapi_cycles_counter = 1;
+}
+
+ulapi_result ulapi_cycles_init(void)
+{
+  (void) pthread_once(&cycles_once, cycles_calibrate);
+
+  return ULAPI_OK;
+}
+
+ulapi_int64 ulapi_cycles(void)
+{
+  if (_ulapi_cycles_counter) return cycles_read();
+
+  return ulapi_time_ns();
+}
+
+ulapi_int64 ulapi_cycles_to_ns(ulapi_int64 cycles)
+{
+  return (ulapi_int64) (cycles * _ulapi_ns_per_cycle);
+}
+
+/*
+  The date and time to the second, kept for each thread so that
+  stamping many log lines in the same second formats it only once.
+*/
+static __thread time_t ts_cached_sec = -1;
+static __thread char ts_cached_prefix[sizeof("1970-01-01T00:00:00")];
+static __thread char ts_ldst[sizeof("1970-01-01T00:00:00.000000000Z padded")];
+
+const char *ulapi_time_string_precise(char *dst, size_t size, ulapi_integer digits)
+{
+  struct timespec ts;
+  struct tm stm;
+  char *tdst = ts_ldst;
+  size_t tsize = sizeof(ts_ldst);
+  size_t len;
+  long frac;
+  int i;
+
+  if (digits < 0 || digits > 9) return NULL;
+
+  if (NULL != dst) {
+    tdst = dst;
+    tsize = size;
+  }
+
+  if (0 != clock_gettime(CLOCK_REALTIME, &ts)) return NULL;
+
+  if (ts.tv_sec != ts_cached_sec) {
+    if (NULL == gmtime_r(&ts.tv_sec, &stm)) return NULL;
+    if (0 == strftime(ts_cached_prefix, sizeof(ts_cached_prefix), "%Y-%m-%dT%H:%M:%S", &stm)) {
+      return NULL;
+    }
+    ts_cached_sec = ts.tv_sec;
+  }
+
+  /* the prefix, the point and digits if any, the Z and the null */
+  len = sizeof(ts_cached_prefix) - 1;
+  if (tsize < len + (digits > 0 ? digits + 1 : 0) + 2) return NULL;
+
+  memcpy(tdst, ts_cached_prefix, len);
+  if (digits > 0) {
+    frac = ts.tv_nsec;
+    for (i = digits; i < 9; i++) frac /= 10;
+    tdst[len] = '.';
+    for (i = digits; i > 0; i--) {
+      tdst[len + i] = (char) ('0' + frac % 10);
+      frac /= 10;
+    }
+    len += digits + 1;
+  }
+  tdst[len] = 'Z';
+  tdst[len + 1] = 0;
+
+  return tdst;
+}
+
+const char *ulapi_time_string(char *dst, size_t size)
+{
+  return ulapi_time_string_precise(dst, size, ULAPI_TIME_SEC);
+}
+
+static ulapi_task_struct *task_self(void);
+static void sleep_until(ulapi_int64 ns);
+static void task_stop_check(ulapi_task_struct *task);
+
+struct fiber_struct;
+/* the fiber the calling thread is running, if any */
+static __thread struct fiber_struct *fiber_current = NULL;
+static void fiber_park(ulapi_int64 release_ns);
+
+void ulapi_sleep(ulapi_real secs)
+{
+  ulapi_task_struct *self;
+
+  /* a fiber lets the others run meanwhile */
+  if (NULL != fiber_current) {
+    fiber_park(ulapi_time_ns() + (ulapi_int64) (secs * 1.0e9));
+    return;
+  }
+
+  /* tasks sleep so that a stop wakes them */
+  self = task_self();
+  if (NULL != self) {
+    task_stop_check(self);
+    sleep_until(ulapi_time_ns() + (ulapi_int64) (secs * 1.0e9));
+    task_stop_check(self);
+    return;
+  }
+
+#ifdef ULAPI_SIM
+  sim_sleep_until(sim_time_ns() + (ulapi_int64) (secs * 1.0e9), NULL);
+#else
+  int isecs, insecs;
+  struct timespec ts;
+
+  isecs = (int) secs;
+  insecs = (int) ((secs - isecs) * 1.0e9);
+
+  ts.tv_sec = isecs;
+  ts.tv_nsec = insecs;
+
+  (void) nanosleep(&ts, NULL);
+#endif
+}
+
+static void quit(int sig)
+{
+  return;
+}
+
+ulapi_result ulapi_app_wait(void)
+{
+  sigset_t mask;
+
+  /* wait until ^C */
+  signal(SIGINT, quit);
+  sigemptyset(&mask);
+#ifdef ULAPI_SIM
+  sim_block(1);
+  sigsuspend(&mask);
+  sim_block(0);
+#else
+  sigsuspend(&mask);
+#endif
+
+  return ULAPI_OK;
+}
+
+static void wait_ready(void);
+
+static ulapi_integer _ulapi_profile = ULAPI_PROFILE_NORMAL;
+
+/*
+  Spreads ULAPI priorities, where 'highest' is numerically lowest,
+  evenly over the SCHED_FIFO priorities, leaving the very top one for
+  the kernel's own watchdog and migration threads.
+*/
+static int prio_to_fifo(ulapi_prio prio)
+{
+  int hi = sched_get_priority_max(SCHED_FIFO) - 1;
+  int lo = sched_get_priority_min(SCHED_FIFO);
+
+  if (prio < ulapi_prio_highest()) prio = ulapi_prio_highest();
+  if (prio > ulapi_prio_lowest()) prio = ulapi_prio_lowest();
+
+  return hi - (prio - ulapi_prio_highest()) * (hi - lo) / (ulapi_prio_lowest() - ulapi_prio_highest());
+}
+
+/*
+  Checks that we may run at the highest real-time priority we'd use,
+  by briefly doing so, and says what's wrong if not.
+*/
+static ulapi_result rt_permitted(void)
+{
+  int policy;
+  struct sched_param old_param, sched_param;
+  struct rlimit rlim;
+  int err;
+
+  if (0 != pthread_getschedparam(pthread_self(), &policy, &old_param)) return ULAPI_ERROR;
+
+  sched_param.sched_priority = prio_to_fifo(ulapi_prio_highest());
+  err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched_param);
+  if (0 == err) {
+    (void) pthread_setschedparam(pthread_self(), policy, &old_param);
+    return ULAPI_OK;
+  }
+
+  fprintf(stderr, "ulapi: can't use the real-time profile, SCHED_FIFO priority %d: %s\n",
+	  (int) sched_param.sched_priority, strerror(err));
+  if (EPERM == err && 0 == getrlimit(RLIMIT_RTPRIO, &rlim)) {
+    fprintf(stderr, "ulapi: run as root, with CAP_SYS_NICE, or raise rtprio from %ld to %d in /etc/security/limits.conf\n",
+	    (long) rlim.rlim_cur, (int) sched_param.sched_priority);
+  }
+
+  return ULAPI_ERROR;
+}
+
+/*
+  The kernel keeps a latency request for as long as the device is held
+  open, so it's opened once and left open until the process exits.
+*/
+static int _ulapi_cpu_latency_fd = -1;
+
+ulapi_result ulapi_cpu_latency_set(ulapi_integer usec)
+{
+  int32_t value;
+
+  if (usec < 0) {
+    if (_ulapi_cpu_latency_fd >= 0) {
+      close(_ulapi_cpu_latency_fd);
+      _ulapi_cpu_latency_fd = -1;
+    }
+    return ULAPI_OK;
+  }
+
+  if (_ulapi_cpu_latency_fd < 0) {
+    _ulapi_cpu_latency_fd = open("/dev/cpu_dma_latency", O_WRONLY | O_CLOEXEC);
+    if (_ulapi_cpu_latency_fd < 0) {
+      fprintf(stderr, "ulapi: can't hold the CPU latency at %d usec, /dev/cpu_dma_latency: %s\n",
+	      (int) usec, strerror(errno));
+      return ULAPI_ERROR;
+    }
+  }
+
+  /* writing again to the same descriptor updates its request */
+  value = usec;
+  if ((ssize_t) sizeof(value) != write(_ulapi_cpu_latency_fd, &value, sizeof(value))) {
+    PERROR("ulapi_cpu_latency_set");
+    return ULAPI_ERROR;
+  }
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_cpu_governor(ulapi_integer cpu, char *dst, size_t size)
+{
+  FILE *fp;
+  char path[128];
+  char *ptr;
+
+  if (cpu < 0 || NULL == dst || 0 == size) return ULAPI_BAD_ARGS;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", (int) cpu);
+  fp = fopen(path, "r");
+  if (NULL == fp) return ULAPI_ERROR;
+  ptr = fgets(dst, size, fp);
+  fclose(fp);
+  if (NULL == ptr) return ULAPI_ERROR;
+
+  for (ptr = dst; 0 != *ptr && ! isspace(*ptr); ptr++);
+  *ptr = 0;
+
+  return ULAPI_OK;
+}
+
+/* unless the application has already asked for a latency itself */
+static void rt_cpu_latency(void)
+{
+  const char *env;
+  ulapi_integer usec = 0;
+
+  if (_ulapi_cpu_latency_fd >= 0) return;
+
+  env = getenv("ULAPI_CPU_LATENCY");
+  if (NULL != env) usec = atoi(env);
+
+  (void) ulapi_cpu_latency_set(usec);
+}
+
+/*
+  Warns, once for each, about CPUs in 'set' whose frequency will wander
+  under load, since a real-time task will run slower until it ramps up.
+*/
+static void rt_governor_check(const cpu_set_t *set)
+{
+  static cpu_set_t warned;
+  char governor[64];
+  int cpu;
+
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (! CPU_ISSET(cpu, set) || CPU_ISSET(cpu, &warned)) continue;
+    CPU_SET(cpu, &warned);
+    if (ULAPI_OK != ulapi_cpu_governor(cpu, governor, sizeof(governor))) continue;
+    if (0 != strcmp(governor, "performance")) {
+      fprintf(stderr, "ulapi: CPU %d has the %s frequency governor, not performance\n",
+	      cpu, governor);
+    }
+  }
+}
+
+ulapi_result ulapi_init_profile(ulapi_integer profile)
+{
+  const char *env;
+
+  if (ULAPI_PROFILE_DEFAULT == profile) {
+    env = getenv("ULAPI_PROFILE");
+    if (NULL == env) return ULAPI_OK;
+    if (0 == strcmp(env, "rt")) profile = ULAPI_PROFILE_RT;
+    else if (0 == strcmp(env, "normal")) profile = ULAPI_PROFILE_NORMAL;
+    else {
+      fprintf(stderr, "ulapi: ignoring unknown ULAPI_PROFILE %s\n", env);
+      return ULAPI_OK;
+    }
+  }
+
+  if (ULAPI_PROFILE_RT == profile) {
+    if (ULAPI_OK != rt_permitted()) {
+      _ulapi_profile = ULAPI_PROFILE_NORMAL;
+      return ULAPI_ERROR;
+    }
+    _ulapi_profile = ULAPI_PROFILE_RT;
+    /* not being able to is a warning, and tasks still run */
+    rt_cpu_latency();
+  } else if (ULAPI_PROFILE_NORMAL == profile) {
+    _ulapi_profile = ULAPI_PROFILE_NORMAL;
+  } else {
+    return ULAPI_BAD_ARGS;
+  }
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_init(void)
+{
+  return ulapi_init_profile(ULAPI_PROFILE_DEFAULT);
+}
+
+ulapi_integer ulapi_get_profile(void)
+{
+  return _ulapi_profile;
+}
+
+ulapi_result ulapi_exit(void)
+{
+  return ULAPI_OK;
+}
+
+ulapi_integer ulapi_to_argv(const char *src, char ***argv)
+{
+  char *cpy;
+  char *ptr;
+  ulapi_integer count;
+  ulapi_flag inquote;
+
+  *argv = NULL;
+  cpy = malloc(strlen(src) + 1);
+  count = 0;
+  inquote = 0;
+
+  for (; ; count++) {
+    while (isspace(*src)) src++;
+    if (0 == *src) return count;
+    ptr = cpy;
+    while (0 != *src) {
+      if ('"' == *src) {
+	inquote = !inquote;
+      } else if ((!inquote) && isspace(*src)) {
+	break;
+      } else {
+	*ptr++ = *src;
+      }
+      src++;
+    }
+    *ptr++ = 0;
+    *argv = realloc(*argv, (count+1)*sizeof(**argv));
+    (*argv)[count] = malloc(strlen(cpy) + 1);
+    strcpy((*argv)[count], cpy);
+  }
+   
+  free(cpy);
+
+  return count;
+}
+
+void ulapi_free_argv(ulapi_integer argc, char **argv)
+{
+  ulapi_integer t;
+
+  for (t = 0; t < argc; t++) {
+    free((char *) argv[t]);
+  }
+  free(argv);
+
+  return;
+}
+
+void ulapi_set_debug(ulapi_integer mask)
+{
+  ulapi_debug_level = mask;
+}
+
+ulapi_integer ulapi_get_debug(void)
+{
+  return ulapi_debug_level;
+}
+
+ulapi_prio ulapi_prio_highest(void)
+{
+  return 1;
+}
+
+ulapi_prio ulapi_prio_lowest(void)
+{
+  return 31;
+}
+
+ulapi_prio ulapi_prio_next_higher(ulapi_prio prio)
+{
+  if (prio == ulapi_prio_highest())
+    return prio;
+
+  return prio - 1;
+}
+
+ulapi_prio ulapi_prio_next_lower(ulapi_prio prio)
+{
+  if (prio == ulapi_prio_lowest())
+    return prio;
+
+  return prio + 1;
+}
+
+/*
+  Each thread started by ulapi_task_start keeps a pointer to its task
+  structure under this key, so that ulapi_wait can find its period
+  and release time.
+*/
+static pthread_key_t task_key;
+static pthread_once_t task_key_once = PTHREAD_ONCE_INIT;
+
+/*
+  Threads not started by ulapi_task_start get a task structure
+  allocated for them by ulapi_self_set_period, freed when they exit.
+  These are recognized by having no task code.
+*/
+static void task_key_free(void *ptr)
+{
+  ulapi_task_struct *task = (ulapi_task_struct *) ptr;
+
+  if (NULL != task && NULL == task->taskcode) free(task);
+}
+
+static void task_key_make(void)
+{
+  (void) pthread_key_create(&task_key, task_key_free);
+}
+
+static ulapi_task_struct *task_self(void)
+{
+  (void) pthread_once(&task_key_once, task_key_make);
+
+  return (ulapi_task_struct *) pthread_getspecific(task_key);
+}
+
+#define NSEC_PER_SEC 1000000000L
+
+/*
+  Sleeps until the absolute CLOCK_MONOTONIC time 'ns', restarting if
+  interrupted by a signal, or for a task until it's asked to stop.
+*/
+static void sleep_until(ulapi_int64 ns)
+{
+  ulapi_task_struct *self;
+
+  self = task_self();
+#ifdef ULAPI_SIM
+  sim_sleep_until(ns, NULL == self ? NULL : &self->stop);
+#else
+  struct timespec ts;
+
+  ts.tv_sec = ns / NSEC_PER_SEC;
+  ts.tv_nsec = ns % NSEC_PER_SEC;
+
+  if (NULL == self) {
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+    return;
+  }
+
+  /*
+    Tasks sleep on their stop word instead, with the same absolute
+    monotonic timeout, so that ulapi_task_stop wakes them at once.
+  */
+  while (! self->stop) {
+    if (0 != syscall(SYS_futex, &self->stop, FUTEX_WAIT_BITSET_PRIVATE, 0, &ts, NULL, FUTEX_BITSET_MATCH_ANY) &&
+	ETIMEDOUT == errno) break;
+  }
+#endif
+}
+
+/* ends the calling task if it's been asked to stop, running its cleanup handlers */
+static void task_stop_check(ulapi_task_struct *task)
+{
+  if (task->stop) pthread_exit(PTHREAD_CANCELED);
+}
+
+/*
+  Sleeps wake up late by the scheduler's wakeup latency. Its running
+  mean, scaled by 8 to keep the fraction, offsets plain relative
+  waits. The guard band of hybrid waits tracks the 99th percentile of
+  it instead, stepping up by an eighth on each sleep that still wakes
+  too late and down by a 99th of that on the others, so a preemption
+  that no guard band would have covered counts no more than any other
+  miss. Concurrent tasks may race here and lose a sample, which is
+  harmless.
+*/
+static ulapi_int64 _ulapi_oversleep_mean8 = 0;
+static double _ulapi_wait_guard_learned = 0.0;
+static ulapi_integer _ulapi_oversleep_samples = 0;
+static ulapi_integer _ulapi_wait_guard_nsec = 0; /* non-zero is fixed */
+static ulapi_flag _ulapi_wait_hybrid_ran = 0; /* so there's something to save */
+
+/* never spin longer than this, however bad the latency gets */
+#define MAX_GUARD_NSEC 1000000
+/* so the guard band can grow from nothing */
+#define GUARD_STEP_NSEC 100
+
+static void oversleep_learn(ulapi_int64 over, ulapi_int64 guard)
+{
+  double step;
+
+  if (over > MAX_GUARD_NSEC) over = MAX_GUARD_NSEC;
+  if (over < 0) over = 0;
+
+  _ulapi_oversleep_mean8 += over - (_ulapi_oversleep_mean8 >> 3);
+
+  step = _ulapi_wait_guard_learned / 8 + GUARD_STEP_NSEC;
+  if (over > guard) _ulapi_wait_guard_learned += step;
+  else _ulapi_wait_guard_learned -= step / 99;
+  if (_ulapi_wait_guard_learned < 0) _ulapi_wait_guard_learned = 0;
+  if (_ulapi_wait_guard_learned > MAX_GUARD_NSEC) _ulapi_wait_guard_learned = MAX_GUARD_NSEC;
+
+  _ulapi_oversleep_samples++;
+}
+
+static ulapi_int64 wait_guard(void)
+{
+  if (0 != _ulapi_wait_guard_nsec) return _ulapi_wait_guard_nsec;
+
+  return (ulapi_int64) _ulapi_wait_guard_learned;
+}
+
+/* hybrid waits shouldn't be made later by the default 50 usec slack */
+static void timer_slack_cut(void)
+{
+#ifdef PR_SET_TIMERSLACK
+  (void) prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+#endif
+}
+
+/*
+  Waits until the absolute time 'deadline' and returns the time of
+  wakeup. Hybrid waits sleep until the guard band before the deadline,
+  learn from how late that was, then spin out the rest.
+*/
+static ulapi_int64 wait_until(ulapi_int64 deadline, ulapi_flag hybrid)
+{
+  ulapi_int64 guard;
+  ulapi_int64 target;
+  ulapi_int64 now;
+
+  if (! hybrid) {
+    sleep_until(deadline);
+    return ulapi_time_ns();
+  }
+
+  guard = wait_guard();
+  now = ulapi_time_ns();
+  /*
+    Sleep through at least half of what's left, so there's always an
+    oversleep to learn from, unless the task overran into the guard band.
+  */
+  target = deadline - guard;
+  if (target < now + (deadline - now) / 2) target = now + (deadline - now) / 2;
+  if (target > now) {
+    sleep_until(target);
+    now = ulapi_time_ns();
+    oversleep_learn(now - target, guard);
+    _ulapi_wait_hybrid_ran = 1;
+  }
+
+  while (now < deadline) {
+    cpu_relax();
+    now = ulapi_time_ns();
+  }
+
+  return now;
+}
+
+/*
+  The learned oversleep is kept for each user, since the machine's
+  users may run different loads, in $ULAPI_WAIT_FILE if that's set,
+  otherwise in $XDG_STATE_HOME/ulapi_wait or ~/.ulapi_wait. Returns
+  NULL if there's nowhere to keep it.
+*/
+static const char *wait_file(char *dst, size_t size)
+{
+  const char *env;
+  int len;
+
+  env = getenv("ULAPI_WAIT_FILE");
+  if (NULL != env && 0 != *env) {
+    len = snprintf(dst, size, "%s", env);
+  } else if (NULL != (env = getenv("XDG_STATE_HOME")) && 0 != *env) {
+    len = snprintf(dst, size, "%s/ulapi_wait", env);
+  } else if (NULL != (env = getenv("HOME")) && 0 != *env) {
+    len = snprintf(dst, size, "%s/.ulapi_wait", env);
+  } else {
+    return NULL;
+  }
+
+  return (len < 0 || (size_t) len >= size) ? NULL : dst;
+}
+
+/*
+  With nothing saved, measures some short sleeps to start from, as
+  they would be made in hybrid waits.
+*/
+static void wait_calibrate(void)
+{
+  enum {CALIBRATE_NUM = 20, CALIBRATE_NSEC = 100000};
+  ulapi_int64 target;
+  ulapi_int64 now;
+  int slack = -1;
+  int t;
+
+#ifdef PR_GET_TIMERSLACK
+  slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+  timer_slack_cut();
+#endif
+
+  for (t = 0; t < CALIBRATE_NUM; t++) {
+    target = ulapi_time_ns() + CALIBRATE_NSEC;
+    sleep_until(target);
+    now = ulapi_time_ns();
+    oversleep_learn(now - target, wait_guard());
+  }
+
+#ifdef PR_SET_TIMERSLACK
+  if (slack > 0) (void) prctl(PR_SET_TIMERSLACK, slack, 0, 0, 0);
+#endif
+}
+
+static void wait_load(void)
+{
+  char path[PATH_MAX];
+  FILE *fp = NULL;
+  long long mean8, guard;
+  int fd;
+  int got = 0;
+
+  if (0 != _ulapi_oversleep_samples) return; /* already learning */
+
+  if (NULL != wait_file(path, sizeof(path))) {
+    fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd >= 0 && NULL == (fp = fdopen(fd, "r"))) close(fd);
+  }
+  if (NULL != fp) {
+    got = fscanf(fp, "%lld %lld", &mean8, &guard);
+    fclose(fp);
+  }
+
+  if (2 == got &&
+      mean8 >= 0 && mean8 <= 8LL * MAX_GUARD_NSEC &&
+      guard >= 0 && guard <= MAX_GUARD_NSEC) {
+    _ulapi_oversleep_mean8 = mean8;
+    _ulapi_wait_guard_learned = (double) guard;
+    _ulapi_oversleep_samples = 1;
+    return;
+  }
+
+  wait_calibrate();
+}
+
+/*
+  Written to a file of our own and renamed over the old one, so that
+  readers never see half of it and a link left in its place is
+  replaced rather than followed. It's only a head start for the next
+  run, so failures don't matter.
+*/
+static void wait_save(void)
+{
+  char path[PATH_MAX];
+  char tmp[PATH_MAX + 16];
+  char buf[64];
+  ulapi_flag ok;
+  int len;
+  int fd;
+
+  /* a process that never made a hybrid wait has learned nothing */
+  if (! _ulapi_wait_hybrid_ran) return;
+  if (NULL == wait_file(path, sizeof(path))) return;
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+  (void) unlink(tmp);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd < 0) return;
+
+  len = snprintf(buf, sizeof(buf), "%lld %lld\n",
+		 (long long) _ulapi_oversleep_mean8,
+		 (long long) _ulapi_wait_guard_learned);
+  ok = (len > 0 && (ssize_t) len == write(fd, buf, len));
+  if (0 != close(fd)) ok = 0;
+
+  if (! ok || 0 != rename(tmp, path)) (void) unlink(tmp);
+}
+
+static pthread_once_t wait_once = PTHREAD_ONCE_INIT;
+
+static void wait_start(void)
+{
+  wait_load();
+  (void) atexit(wait_save);
+}
+
+/*
+  Picks up the oversleep learned in earlier runs, or measures it, the
+  first time a wait uses it, so that programs that never wait don't
+  pay for it. Simulations have no real sleeps to learn from.
+*/
+static void wait_ready(void)
+{
+  if (! SIM_BUILD) (void) pthread_once(&wait_once, wait_start);
+}
+
+ulapi_result ulapi_wait_guard_set(ulapi_integer guard_nsec)
+{
+  if (guard_nsec < 0 || guard_nsec > MAX_GUARD_NSEC) return ULAPI_BAD_ARGS;
+
+  _ulapi_wait_guard_nsec = guard_nsec;
+
+  return ULAPI_OK;
+}
+
+ulapi_integer ulapi_wait_guard_get(void)
+{
+  wait_ready();
+
+  return (ulapi_integer) wait_guard();
+}
+
+/*
+  The registry of tasks from ulapi_task_new, linked through the tasks
+  themselves, and of other tasks while they're started, so that
+  admission control sees them all. Tasks update their own state and
+  counts without the mutex, since readers only want a recent picture.
+*/
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ulapi_task_struct *registry_head = NULL;
+
+static void registry_add(ulapi_task_struct *task)
+{
+  pthread_mutex_lock(&registry_mutex);
+  task->registry_next = registry_head;
+  registry_head = task;
+  pthread_mutex_unlock(&registry_mutex);
+}
+
+/* with the mutex held, whether the task is in the registry */
+static ulapi_flag registry_has(ulapi_task_struct *task)
+{
+  ulapi_task_struct *t;
+
+  for (t = registry_head; NULL != t; t = (ulapi_task_struct *) t->registry_next) {
+    if (t == task) return 1;
+  }
+
+  return 0;
+}
+
+/* with the mutex held */
+static void registry_unlink(ulapi_task_struct *task)
+{
+  ulapi_task_struct **pp;
+
+  for (pp = &registry_head; NULL != *pp; pp = (ulapi_task_struct **) &(*pp)->registry_next) {
+    if (*pp == task) {
+      *pp = (ulapi_task_struct *) task->registry_next;
+      break;
+    }
+  }
+  task->registry_started = 0;
+}
+
+static void registry_remove(ulapi_task_struct *task)
+{
+  pthread_mutex_lock(&registry_mutex);
+  registry_unlink(task);
+  pthread_mutex_unlock(&registry_mutex);
+}
+
+/* whether a task's releases are to be, or have been, put in phase */
+enum {PHASE_NONE = 0, PHASE_WANTED, PHASE_ALIGNED};
+
+ulapi_result ulapi_task_init(ulapi_task_struct *task)
+{
+  int policy;
+  struct sched_param sched_param;
+  ulapi_flag registered, started;
+  void *next;
+
+  /* real-time tasks get their scheduling when they're started */
+  if (ULAPI_PROFILE_RT != _ulapi_profile) {
+    if (0 != pthread_getschedparam(pthread_self(), &policy, &sched_param)) return ULAPI_ERROR;
+    if (0 != pthread_setschedparam(pthread_self(), SCHED_OTHER, &sched_param)) return ULAPI_ERROR;
+  }
+  if (0 != pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) return ULAPI_ERROR;
+  /* only ulapi_task_kill cancels, and then only at a cancellation point */
+  if (0 != pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL)) return ULAPI_ERROR;
+
+  if (NULL != task) {
+    /*
+      A task from ulapi_task_new stays in the registry, where it's
+      linked. Others may be uninitialized memory, so the registry is
+      searched for the task rather than trusting its link.
+    */
+    pthread_mutex_lock(&registry_mutex);
+    registered = registry_has(task);
+    next = task->registry_next;
+    started = task->registry_started;
+    memset(task, 0, sizeof(*task));
+    if (registered) {
+      task->registry_next = next;
+      task->registry_started = started;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+  }
+
+  return ULAPI_OK;
+}
+
+/*
+  Admission control for periodic tasks, by response-time analysis of
+  the tasks sharing a CPU at their fixed priorities. A task's cost is
+  the larger of the worst-case execution time declared for it and the
+  most CPU time a cycle of it has taken. Its wall-clock time would
+  count preemption by the other tasks, which the analysis adds itself,
+  and time spent blocked. Tasks count as sharing a CPU when it's the
+  only one they may run on.
+*/
+static ulapi_integer _ulapi_admission = ULAPI_ADMIT_WARN;
+
+ulapi_result ulapi_admission_set(ulapi_integer mode)
+{
+  if (ULAPI_ADMIT_OFF != mode && ULAPI_ADMIT_WARN != mode && ULAPI_ADMIT_REFUSE != mode) {
+    return ULAPI_BAD_ARGS;
+  }
+  _ulapi_admission = mode;
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_task_set_wcet(ulapi_task_struct *task, ulapi_int64 wcet_nsec)
+{
+  if (NULL == task || wcet_nsec < 0) return ULAPI_BAD_ARGS;
+
+  task->wcet_ns = wcet_nsec;
+
+  return ULAPI_OK;
+}
+
+/*
+  The one CPU the task may run on, or -1. Without CPUs of its own, a
+  task about to be started inherits the caller's affinity, and a
+  running one has whatever its thread has now.
+*/
+static ulapi_integer task_only_cpu(ulapi_task_struct *task, ulapi_task_struct *adding)
+{
+  cpu_set_t set;
+  int cpu;
+
+  if (NULL != task->cpus) {
+    set = *(cpu_set_t *) task->cpus;
+  } else if (task == adding) {
+    if (0 != sched_getaffinity(0, sizeof(set), &set)) return -1;
+  } else if (0 != pthread_getaffinity_np(task->tid, sizeof(set), &set)) {
+    return -1;
+  }
+  if (1 != CPU_COUNT(&set)) return -1;
+
+  for (cpu = 0; ! CPU_ISSET(cpu, &set); cpu++);
+
+  return cpu;
+}
+
+static ulapi_int64 task_cost(ulapi_task_struct *task)
+{
+  return task->cpu_max_ns > task->wcet_ns ? task->cpu_max_ns : task->wcet_ns;
+}
+
+/*
+  With the registry mutex held, checks the periodic tasks on 'cpu'
+  that have been admitted and not yet ended, and 'adding' if not
+  NULL. Lower priority values are higher priorities, and tasks at the
+  same priority are counted as delaying each other. Warns about the
+  first task that could miss a release, prefixed with 'who', and
+  returns ULAPI_ERROR if there is one.
+*/
+static ulapi_result admission_check(ulapi_integer cpu, ulapi_task_struct *adding, const char *who)
+{
+  ulapi_task_struct *task, *other;
+  ulapi_real util = 0.0;
+  ulapi_int64 cost, r, next;
+
+  for (task = registry_head; NULL != task; task = (ulapi_task_struct *) task->registry_next) {
+    if (task != adding && ! task->admitted) continue;
+    if (0 == task->period_nsec || cpu != task_only_cpu(task, adding)) continue;
+    util += (ulapi_real) task_cost(task) / task->period_nsec;
+  }
+
+  for (task = registry_head; NULL != task; task = (ulapi_task_struct *) task->registry_next) {
+    if (task != adding && ! task->admitted) continue;
+    if (0 == task->period_nsec || cpu != task_only_cpu(task, adding)) continue;
+    cost = task_cost(task);
+    if (0 == cost) continue;	/* nothing known, so nothing to say */
+
+    /* iterate to the worst-case response, if it's within the period */
+    for (r = cost; r <= task->period_nsec; r = next) {
+      next = cost;
+      for (other = registry_head; NULL != other; other = (ulapi_task_struct *) other->registry_next) {
+	if (other == task || other->prio > task->prio) continue;
+	if (other != adding && ! other->admitted) continue;
+	if (0 == other->period_nsec || cpu != task_only_cpu(other, adding)) continue;
+	next += (r + other->period_nsec - 1) / other->period_nsec * task_cost(other);
+      }
+      if (next == r) break;
+    }
+
+    if (r > task->period_nsec) {
+      fprintf(stderr, "%s: tasks on CPU %d are unschedulable at %.0f%% utilization: %s%s%s period %d usec, cost %lld usec, could respond in over %lld usec\n",
+	      who, (int) cpu, util * 100.0,
+	      0 != task->name[0] ? "'" : "", 0 != task->name[0] ? task->name : "a task", 0 != task->name[0] ? "'" : "",
+	      (int) (task->period_nsec / 1000), (long long) (cost / 1000), (long long) (r / 1000));
+      return ULAPI_ERROR;
+    }
+  }
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_admission_check(ulapi_integer cpu)
+{
+  ulapi_result result = ULAPI_OK;
+  ulapi_integer c;
+
+  pthread_mutex_lock(&registry_mutex);
+  for (c = (cpu < 0 ? 0 : cpu); c < (cpu < 0 ? CPU_SETSIZE : cpu + 1); c++) {
+    if (ULAPI_OK != admission_check(c, NULL, "ulapi_admission_check")) result = ULAPI_ERROR;
+  }
+  pthread_mutex_unlock(&registry_mutex);
+
+  return result;
+}
+
+ulapi_task_struct *ulapi_task_new(void)
+{
+  ulapi_task_struct *ts = malloc(sizeof(ulapi_task_struct));
+  if (NULL == ts) return NULL;
+
+  if (ULAPI_OK != ulapi_task_init(ts)) {
+    free(ts);
+    return NULL;
+  }
+
+  registry_add(ts);
+
+  return ts;
+}
+
+#define STACK_PAINT 0xDEADBEEF
+/*
+  Real-time tasks without a stack size get this much, painted and
+  locked, rather than the pthread default, which is often 8 MB and
+  would soon use up a normal RLIMIT_MEMLOCK.
+*/
+#define RT_STACK_DEFAULT (256 * 1024)
+
+/* the task must have finished with it */
+static void stack_free(ulapi_task_struct *task)
+{
+  if (NULL == task->stack) return;
+
+  (void) munlock(task->stack, task->stack_mapped);
+  (void) munmap(task->stack, task->stack_mapped);
+  task->stack = NULL;
+  task->stack_mapped = 0;
+}
+
+/*
+  Maps a stack of 'size' bytes under a guard page, and paints it,
+  which faults in every page, then locks it so it stays that way.
+  Locking may not be permitted, which costs only the guarantee, so
+  that's reported, once, and the task still runs.
+*/
+static ulapi_result stack_make(ulapi_task_struct *task, size_t size)
+{
+  static ulapi_flag warned = 0;
+  struct rlimit rlim;
+  size_t page;
+  unsigned int *ptr, *end;
+
+  page = (size_t) sysconf(_SC_PAGESIZE);
+  if (size < (size_t) PTHREAD_STACK_MIN) size = (size_t) PTHREAD_STACK_MIN;
+  size = (size + page - 1) / page * page;
+
+  stack_free(task);
+
+  task->stack = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (MAP_FAILED == task->stack) {
+    task->stack = NULL;
+    return ULAPI_ERROR;
+  }
+  task->stack_mapped = size + page;
+
+  /* stacks grow down, so the guard page goes at the bottom */
+  (void) mprotect(task->stack, page, PROT_NONE);
+
+  end = (unsigned int *) ((char *) task->stack + task->stack_mapped);
+  for (ptr = (unsigned int *) ((char *) task->stack + page); ptr < end; ptr++) {
+    *ptr = STACK_PAINT;
+  }
+
+  if (0 != mlock((char *) task->stack + page, size) && ! warned) {
+    warned = 1;
+    fprintf(stderr, "ulapi_task_start: can't lock a %lu byte task stack in memory: %s\n",
+	    (unsigned long) size, strerror(errno));
+    if (0 == getrlimit(RLIMIT_MEMLOCK, &rlim) && RLIM_INFINITY != rlim.rlim_cur) {
+      fprintf(stderr, "ulapi_task_start: run as root, with CAP_IPC_LOCK, or raise memlock from %lu KB in /etc/security/limits.conf\n",
+	      (unsigned long) (rlim.rlim_cur / 1024));
+    }
+  }
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_task_set_stacksize(ulapi_task_struct *task, size_t stacksize)
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+
+  task->stacksize = task->prog_stacksize = stacksize;
+
+  return ULAPI_OK;
+}
+
+ulapi_integer ulapi_task_stack_check(ulapi_task_struct *task)
+{
+  unsigned int *ptr, *end;
+  ulapi_integer words = 0;
+
+  if (NULL == task || NULL == task->stack) return -1;
+
+  /* count up from the bottom until the paint has been overwritten */
+  ptr = (unsigned int *) ((char *) task->stack + sysconf(_SC_PAGESIZE));
+  end = (unsigned int *) ((char *) task->stack + task->stack_mapped);
+  for (; ptr < end && STACK_PAINT == *ptr; ptr++) words++;
+
+  return words;
+}
+
+/* copies a cpu_set_t, or NULL for any CPU, allocating the copy if need be */
+static ulapi_result cpus_copy(void **dst, const void *src)
+{
+  if (NULL == src) {
+    free(*dst);
+    *dst = NULL;
+    return ULAPI_OK;
+  }
+  if (NULL == *dst && NULL == (*dst = malloc(sizeof(cpu_set_t)))) return ULAPI_ERROR;
+  *((cpu_set_t *) *dst) = *((const cpu_set_t *) src);
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_task_clear(ulapi_task_struct *task)
+{
+  if (NULL == task) return ULAPI_OK;
+
+  (void) cpus_copy(&task->cpus, NULL);
+  (void) cpus_copy(&task->prog_cpus, NULL);
+
+  stack_free(task);
+
+  task->histograms = 0;
+  (void) ulapi_histogram_delete(task->latency_hist);
+  task->latency_hist = NULL;
+  (void) ulapi_histogram_delete(task->exec_hist);
+  task->exec_hist = NULL;
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_task_delete(ulapi_task_struct *task)
+{
+  if (NULL != task) {
+    registry_remove(task);
+    (void) ulapi_task_clear(task);
+    free(task);
+  }
+
+  return ULAPI_OK;
+}
+
+/*
+  A thread's CPU time, read through its CPU-time clock, so only while
+  the thread hasn't been joined.
+*/
+static ulapi_int64 thread_cpu_ns(pthread_t tid)
+{
+  struct timespec ts;
+  clockid_t cid;
+
+  if (0 != pthread_getcpuclockid(tid, &cid)) return 0;
+  if (0 != clock_gettime(cid, &ts)) return 0;
+
+  return ((ulapi_int64) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*
+  Run however the task ends, even if stopped. Its state changes under
+  the registry lock, so that a listing that sees it running can read
+  its clock before it can be joined.
+*/
+static void task_done(void *arg)
+{
+  ulapi_task_struct *task = (ulapi_task_struct *) arg;
+
+  pthread_mutex_lock(&registry_mutex);
+  task->cpu_ns = thread_cpu_ns(pthread_self());
+  task->state = ULAPI_TASK_DONE;
+  task->admitted = 0;
+  /* before it's joined, after which it may be gone */
+  if (task->registry_started) registry_unlink(task);
+  pthread_mutex_unlock(&registry_mutex);
+}
+
+ulapi_result ulapi_task_set_policy(ulapi_task_struct *task, ulapi_integer policy)
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+  if (ULAPI_POLICY_DEFAULT != policy && ULAPI_POLICY_FIFO != policy &&
+      ULAPI_POLICY_RR != policy && ULAPI_POLICY_OTHER != policy) return ULAPI_BAD_ARGS;
+
+  task->policy = task->prog_policy = policy;
+
+  return ULAPI_OK;
+}
+
+/* the Linux policy a task is started with, or -1 to inherit the caller's */
+static int task_sched_policy(ulapi_task_struct *task)
+{
+  switch (task->policy) {
+  case ULAPI_POLICY_FIFO: return SCHED_FIFO;
+  case ULAPI_POLICY_RR: return SCHED_RR;
+  case ULAPI_POLICY_OTHER: return SCHED_OTHER;
+  }
+
+  return ULAPI_PROFILE_RT == _ulapi_profile ? SCHED_FIFO : -1;
+}
+
+/*
+  The task configuration file, if any. Tasks with a name are looked
+  up in it each time they're started, so it can be edited between runs
+  or restarts, and it's read under the mutex since ini_find isn't
+  reentrant.
+*/
+static pthread_mutex_t task_config_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *task_config_path = NULL;
+static ulapi_flag task_config_set = 0;
+
+static ulapi_result cpus_parse(const char *cpus, cpu_set_t *set);
+
+ulapi_result ulapi_task_config(const char *path)
+{
+  char *cpy = NULL;
+
+  if (NULL != path) {
+    cpy = strdup(path);
+    if (NULL == cpy) return ULAPI_ERROR;
+  }
+
+  pthread_mutex_lock(&task_config_mutex);
+  free(task_config_path);
+  task_config_path = cpy;
+  task_config_set = 1;
+  pthread_mutex_unlock(&task_config_mutex);
+
+  return ULAPI_OK;
+}
+
+static void task_config_bad(const char *path, const char *section, const char *tag, const char *val)
+{
+  fprintf(stderr, "ulapi_task_start: ignoring %s = %s in [%s] of %s\n", tag, val, section, path);
+}
+
+/*
+  Overrides how the task will be started with its section, if it has
+  one, after undoing what the section set when it was last started.
+*/
+static ulapi_result task_config_apply(ulapi_task_struct *task, ulapi_prio *prio, ulapi_integer *period_nsec)
+{
+  char section[sizeof("TASK ") + ULAPI_TASK_NAME_LEN];
+  const char *env;
+  const char *val;
+  FILE *fp;
+  cpu_set_t set;
+  long long ll;
+  int i;
+
+  task->stacksize = task->prog_stacksize;
+  task->policy = task->prog_policy;
+  if (ULAPI_OK != cpus_copy(&task->cpus, task->prog_cpus)) return ULAPI_ERROR;
+
+  if (0 == task->name[0]) return ULAPI_OK;
+
+  pthread_mutex_lock(&task_config_mutex);
+
+  if (! task_config_set) {
+    env = getenv("ULAPI_TASK_CONFIG");
+    if (NULL != env && 0 != *env) task_config_path = strdup(env);
+    task_config_set = 1;
+  }
+  if (NULL == task_config_path) {
+    pthread_mutex_unlock(&task_config_mutex);
+    return ULAPI_OK;
+  }
+
+  fp = fopen(task_config_path, "r");
+  if (NULL == fp) {
+    fprintf(stderr, "ulapi_task_start: can't open task config %s\n", task_config_path);
+    pthread_mutex_unlock(&task_config_mutex);
+    return ULAPI_OK;
+  }
+
+  ulapi_snprintf(section, sizeof(section), "TASK %s", task->name);
+  if (ini_has_section(fp, section)) {
+    if (NULL != (val = ini_find(fp, "PRIORITY", section))) {
+      if (1 == sscanf(val, "%i", &i) && i >= ulapi_prio_highest() && i <= ulapi_prio_lowest()) *prio = i;
+      else task_config_bad(task_config_path, section, "PRIORITY", val);
+    }
+    if (NULL != (val = ini_find(fp, "PERIOD_NSEC", section))) {
+      if (1 == sscanf(val, "%lli", &ll) && ll >= 0 && ll <= 0x7FFFFFFF) *period_nsec = (ulapi_integer) ll;
+      else task_config_bad(task_config_path, section, "PERIOD_NSEC", val);
+    }
+    if (NULL != (val = ini_find(fp, "CPUS", section))) {
+      if (ULAPI_OK != cpus_parse(val, &set) || 0 == CPU_COUNT(&set)) {
+	task_config_bad(task_config_path, section, "CPUS", val);
+      } else if (ULAPI_OK != cpus_copy(&task->cpus, &set)) {
+	fclose(fp);
+	pthread_mutex_unlock(&task_config_mutex);
+	return ULAPI_ERROR;
+      }
+    }
+    if (NULL != (val = ini_find(fp, "STACKSIZE", section))) {
+      if (1 == sscanf(val, "%lli", &ll) && ll >= 0) task->stacksize = (size_t) ll;
+      else task_config_bad(task_config_path, section, "STACKSIZE", val);
+    }
+    if (NULL != (val = ini_find(fp, "POLICY", section))) {
+      if (ini_match(val, "FIFO")) task->policy = ULAPI_POLICY_FIFO;
+      else if (ini_match(val, "RR")) task->policy = ULAPI_POLICY_RR;
+      else if (ini_match(val, "OTHER")) task->policy = ULAPI_POLICY_OTHER;
+      else if (ini_match(val, "DEFAULT")) task->policy = ULAPI_POLICY_DEFAULT;
+      else task_config_bad(task_config_path, section, "POLICY", val);
+    }
+  }
+
+  fclose(fp);
+  pthread_mutex_unlock(&task_config_mutex);
+
+  return ULAPI_OK;
+}
+
+/*
+  All tasks start here, so that the task structure can be found by
+  the task's own calls to ulapi_wait.
+*/
+static void *task_wrapper(void *arg)
+{
+  ulapi_task_struct *task = (ulapi_task_struct *) arg;
+  char name[16];
+
+  (void) pthread_once(&task_key_once, task_key_make);
+  (void) pthread_setspecific(task_key, task);
+#ifdef ULAPI_SIM
+  sim_arrive();
+#endif
+
+  task->os_tid = (ulapi_integer) syscall(SYS_gettid);
+  task->cpu = sched_getcpu();
+  task->state = ULAPI_TASK_RUNNING;
+  if (0 != task->name[0]) {
+    strncpy(name, task->name, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    (void) pthread_setname_np(pthread_self(), name);
+  }
+
+  pthread_cleanup_push(task_done, task);
+  task->taskcode(task->taskarg);
+  pthread_cleanup_pop(1);
+
+  return NULL;
+}
+
+ulapi_result
+ulapi_task_start(ulapi_task_struct *task,
+		 void (*taskcode)(void *),
+		 void *taskarg,
+		 ulapi_prio prio,
+		 ulapi_integer period_nsec)
+{
+  pthread_attr_t attr;
+  struct sched_param sched_param;
+  cpu_set_t cpus;
+  size_t stacksize;
+  ulapi_integer cpu;
+  int policy;
+  int retval;
+
+  if (NULL == task || NULL == taskcode) return ULAPI_BAD_ARGS;
+
+  /* what it's started with, for a restart after the configuration changes */
+  task->prog_prio = prio;
+  task->prog_period_nsec = period_nsec;
+  /* the machine's configuration wins over what's compiled in */
+  if (ULAPI_OK != task_config_apply(task, &prio, &period_nsec)) return ULAPI_ERROR;
+
+  task->taskcode = taskcode;
+  task->taskarg = taskarg;
+  task->stop = 0;
+  task->prio = prio;
+  task->start_ns = ulapi_time_ns();
+  /* a restarted task measures this run, not the one before */
+  task->wake_ns = task->wake_cpu_ns = 0;
+  task->cycles = 0;
+  task->cpu_min_ns = task->cpu_max_ns = task->cpu_sum_ns = task->cpu_cycles = 0;
+  task->budget_overruns = 0;
+  task->overruns = task->worst_overrun_ns = 0;
+  task->cpu_ns = 0;
+  if (NULL != task->latency_hist) ulapi_histogram_reset(task->latency_hist);
+  if (NULL != task->exec_hist) ulapi_histogram_reset(task->exec_hist);
+  if (period_nsec < 0) period_nsec = 0;
+  /* periodic tasks are what gets timed, so calibrate before they run */
+  if (period_nsec > 0) (void) ulapi_cycles_init();
+  task->period_nsec = task->next_period_nsec = period_nsec;
+  /* the first release is one period from now */
+  task->release_ns = ulapi_time_ns();
+  /* or in phase again, if it was before it was stopped */
+  if (PHASE_ALIGNED == task->phase) task->phase = PHASE_WANTED;
+
+  pthread_attr_init(&attr);
+  policy = task_sched_policy(task);
+  if (policy >= 0) {
+    /* without explicit scheduling, the attributes are ignored */
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, policy);
+    sched_param.sched_priority = (SCHED_OTHER == policy ? 0 : prio_to_fifo(prio));
+  } else {
+    sched_param.sched_priority = prio;
+  }
+  pthread_attr_setschedparam(&attr, &sched_param);
+  if (NULL != task->cpus) {
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), (cpu_set_t *) task->cpus);
+  }
+  if (ULAPI_PROFILE_RT == _ulapi_profile) {
+    if (NULL != task->cpus) rt_governor_check((cpu_set_t *) task->cpus);
+    else if (0 == sched_getaffinity(0, sizeof(cpus), &cpus)) rt_governor_check(&cpus);
+  }
+  stacksize = task->stacksize;
+  if (0 == stacksize && ULAPI_PROFILE_RT == _ulapi_profile) {
+    stacksize = RT_STACK_DEFAULT;
+  }
+  if (0 != stacksize) {
+    if (ULAPI_OK != stack_make(task, stacksize)) {
+      pthread_attr_destroy(&attr);
+      return ULAPI_ERROR;
+    }
+    /* the usable part, above the guard page */
+    pthread_attr_setstack(&attr,
+			  (char *) task->stack + sysconf(_SC_PAGESIZE),
+			  task->stack_mapped - sysconf(_SC_PAGESIZE));
+  } else {
+    /* one from before its configuration changed */
+    stack_free(task);
+  }
+
+  /*
+    Held until the thread has been created, and the task marked as
+    admitted, so that tasks started at the same time each see the
+    others in their admission checks.
+  */
+  pthread_mutex_lock(&registry_mutex);
+  /* one not from ulapi_task_new is listed while it runs */
+  if (! registry_has(task)) {
+    task->registry_next = registry_head;
+    registry_head = task;
+    task->registry_started = 1;
+  }
+  if (period_nsec > 0 && ULAPI_ADMIT_OFF != _ulapi_admission &&
+      (cpu = task_only_cpu(task, task)) >= 0) {
+    retval = admission_check(cpu, task, "ulapi_task_start");
+    if (ULAPI_OK != retval && ULAPI_ADMIT_REFUSE == _ulapi_admission) {
+      if (task->registry_started) registry_unlink(task);
+      pthread_mutex_unlock(&registry_mutex);
+      pthread_attr_destroy(&attr);
+      task->period_nsec = task->next_period_nsec = 0;
+      return ULAPI_ERROR;
+    }
+  }
+  task->admitted = 1;
+#ifdef ULAPI_SIM
+  sim_expect();
+#endif
+  retval = pthread_create(&task->tid, &attr, task_wrapper, task);
+  pthread_attr_destroy(&attr);
+#ifdef ULAPI_SIM
+  if (0 != retval) sim_leave(NULL);
+#endif
+  if (0 != retval) {
+    task->admitted = 0;
+    if (task->registry_started) registry_unlink(task);
+  }
+  pthread_mutex_unlock(&registry_mutex);
+
+  if (EPERM == retval) {
+    fprintf(stderr, "ulapi_task_start: not permitted to run at %s priority %d\n",
+	    SCHED_RR == policy ? "SCHED_RR" : "SCHED_FIFO", (int) sched_param.sched_priority);
+  }
+
+  return (0 == retval ? ULAPI_OK : ULAPI_ERROR);
+}
+
+ulapi_result ulapi_task_stop(ulapi_task_struct *task)
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+
+  task->stop = 1;
+  __sync_synchronize();
+  /* wherever it's waiting, sleeping or parked */
+  (void) syscall(SYS_futex, &task->stop, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  (void) syscall(SYS_futex, &task->paused, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#ifdef ULAPI_SIM
+  sim_stop(&task->stop);
+#endif
+
+  return ULAPI_OK;
+}
+
+ulapi_flag ulapi_self_stop_requested(void)
+{
+  ulapi_task_struct *self;
+
+  self = task_self();
+
+  return NULL != self && self->stop;
+}
+
+ulapi_result ulapi_task_kill(ulapi_task_struct *task)
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+
+  task->stop = 1;
+
+  return (pthread_cancel(task->tid) == 0 ? ULAPI_OK : ULAPI_ERROR);
+}
+
+ulapi_result ulapi_task_restart(ulapi_task_struct *task, ulapi_int64 timeout_nsec)
+{
+  void (*taskcode)(void *);
+  void *taskarg;
+  ulapi_prio prio;
+  ulapi_integer period_nsec;
+
+  if (NULL == task || NULL == task->taskcode) return ULAPI_BAD_ARGS;
+
+  /* as it was started, with any period set since, configured afresh */
+  taskcode = task->taskcode;
+  taskarg = task->taskarg;
+  prio = task->prog_prio;
+  period_nsec = task->prog_period_nsec;
+
+  (void) ulapi_task_stop(task);
+  if (ULAPI_OK != ulapi_task_join_timeout(task, timeout_nsec, NULL)) {
+    /* it's blocked somewhere other than a wait */
+    if (ULAPI_OK != ulapi_task_kill(task)) return ULAPI_ERROR;
+    if (ULAPI_OK != ulapi_task_join_timeout(task, timeout_nsec, NULL)) return ULAPI_ERROR;
+  }
+  task->paused = 0;
+
+  return ulapi_task_start(task, taskcode, taskarg, prio, period_nsec);
+}
+
+ulapi_result ulapi_task_pause(ulapi_task_struct *task)
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+
+  /* it sees this at its next wait */
+  task->paused = 1;
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_task_resume(ulapi_task_struct *task)
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+
+  task->paused = 0;
+  __sync_synchronize();
+  (void) syscall(SYS_futex, &task->paused, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+
+  return ULAPI_OK;
+}
+
+/*
+  Parks the calling task while it's paused. Returns non-zero if it
+  was, so the caller can put it back on its schedule.
+*/
+static ulapi_flag task_park(ulapi_task_struct *task)
+{
+  if (! task->paused) return 0;
+
+  task->state = ULAPI_TASK_PAUSED;
+#ifdef ULAPI_SIM
+  sim_block(1);
+#endif
+  /* a resume between the check and the wait makes the wait return at once */
+  while (task->paused && ! task->stop) {
+    (void) syscall(SYS_futex, &task->paused, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+  }
+#ifdef ULAPI_SIM
+  sim_block(0);
+#endif
+  task->state = ULAPI_TASK_RUNNING;
+
+  return 1;
+}
+
+/* bookkeeping as the calling task comes back from a wait */
+static void task_woke(ulapi_task_struct *task)
+{
+  task->state = ULAPI_TASK_RUNNING;
+  task->cycles++;
+  task->cpu = sched_getcpu();
+}
+
+ulapi_result ulapi_task_set_name(ulapi_task_struct *task, const char *name)
+{
+  char tname[16];
+
+  if (NULL == task || NULL == name) return ULAPI_BAD_ARGS;
+
+  strncpy(task->name, name, sizeof(task->name) - 1);
+  task->name[sizeof(task->name) - 1] = 0;
+
+  /* tasks not started yet are named when they are */
+  if (ULAPI_TASK_NEW == task->state || ULAPI_TASK_DONE == task->state) return ULAPI_OK;
+
+  strncpy(tname, name, sizeof(tname) - 1);
+  tname[sizeof(tname) - 1] = 0;
+
+  return 0 == pthread_setname_np(task->tid, tname) ? ULAPI_OK : ULAPI_ERROR;
+}
+
+static void task_info_fill(ulapi_task_struct *task, ulapi_task_info *info)
+{
+  memcpy(info->name, task->name, sizeof(info->name));
+  info->os_tid = task->os_tid;
+  info->prio = task->prio;
+  info->period_nsec = 0 != task->period_nsec ? task->period_nsec : task->next_period_nsec;
+  info->cpu = task->cpu;
+  info->state = task->state;
+  info->start_ns = task->start_ns;
+  info->cycles = task->cycles;
+  info->overruns = task->overruns;
+  if (ULAPI_TASK_NEW == info->state || ULAPI_TASK_DONE == info->state) {
+    info->cpu_ns = task->cpu_ns;
+  } else {
+    info->cpu_ns = thread_cpu_ns(task->tid);
+  }
+}
+
+ulapi_integer ulapi_task_list(ulapi_task_info *info, ulapi_integer max)
+{
+  ulapi_task_struct *task;
+  ulapi_integer count = 0;
+
+  pthread_mutex_lock(&registry_mutex);
+  for (task = registry_head; NULL != task; task = (ulapi_task_struct *) task->registry_next) {
+    if (NULL != info && count < max) task_info_fill(task, &info[count]);
+    count++;
+  }
+  pthread_mutex_unlock(&registry_mutex);
+
+  return count;
+}
+
+static ulapi_task_registry *registry_shm = NULL;
+static void *registry_timer = NULL;
+
+static void registry_export_code(void *arg)
+{
+  ulapi_task_registry *reg = registry_shm;
+  ulapi_task_struct *task;
+  ulapi_integer count = 0;
+
+  (void) arg;
+
+  reg->seq++;
+  __sync_synchronize();
+
+  pthread_mutex_lock(&registry_mutex);
+  for (task = registry_head; NULL != task; task = (ulapi_task_struct *) task->registry_next) {
+    if (count < ULAPI_TASK_REGISTRY_MAX) task_info_fill(task, &reg->tasks[count]);
+    count++;
+  }
+  pthread_mutex_unlock(&registry_mutex);
+
+  reg->count = count < ULAPI_TASK_REGISTRY_MAX ? count : ULAPI_TASK_REGISTRY_MAX;
+  reg->updated_ns = ulapi_time_ns();
+  reg->pid = (ulapi_integer) getpid();
+  reg->magic = ULAPI_TASK_REGISTRY_MAGIC;
+
+  __sync_synchronize();
+  reg->seq++;
+}
+
+ulapi_result ulapi_task_registry_export(ulapi_id key, ulapi_int64 period_nsec)
+{
+  void *shm;
+
+  if (period_nsec <= 0) return ULAPI_BAD_ARGS;
+
+  if (NULL == registry_shm) {
+    shm = ulapi_shm_new(key, sizeof(ulapi_task_registry));
+    if (NULL == shm) return ULAPI_ERROR;
+    registry_timer = ulapi_timer_new(registry_export_code, NULL);
+    if (NULL == registry_timer) {
+      (void) ulapi_shm_delete(shm);
+      return ULAPI_ERROR;
+    }
+    registry_shm = (ulapi_task_registry *) ulapi_shm_addr(shm);
+    /* an odd sequence left by a process that died mid-update */
+    if (registry_shm->seq & 1) registry_shm->seq++;
+  }
+
+  return ulapi_timer_arm(registry_timer, 0, period_nsec);
+}
+
+ulapi_result ulapi_task_set_phase(ulapi_task_struct *task, ulapi_int64 offset_nsec)
+{
+  if (NULL == task || offset_nsec < 0) return ULAPI_BAD_ARGS;
+
+  task->phase_ns = offset_nsec;
+  task->phase = PHASE_WANTED;
+
+  return ULAPI_OK;
+}
+
+/*
+  Moves the task's next release to the first time after 'now' that's
+  its phase offset past a multiple of its period from the time base
+  epoch, if the time base has been published.
+*/
+static void task_phase_align(ulapi_task_struct *task, ulapi_int64 now)
+{
+  ulapi_int64 epoch;
+  ulapi_int64 ref;
+  ulapi_int64 next;
+
+  if (ULAPI_OK != ulapi_timebase_get(&epoch, NULL)) return;
+
+  ref = epoch + task->phase_ns;
+  if (now >= ref) {
+    next = ref + ((now - ref) / task->period_nsec + 1) * task->period_nsec;
+  } else {
+    next = ref - ((ref - now) / task->period_nsec) * task->period_nsec;
+    if (next <= now) next += task->period_nsec;
+  }
+
+  task->release_ns = next;
+  task->phase = PHASE_ALIGNED;
+}
+
+ulapi_result ulapi_task_set_period(ulapi_task_struct *task, ulapi_integer period_nsec)
+{
+  if (NULL == task || period_nsec < 0) return ULAPI_BAD_ARGS;
+
+  /* picked up by the task at its next call to ulapi_wait */
+  task->next_period_nsec = task->prog_period_nsec = period_nsec;
+  /* the old phase is lost with the old period */
+  if (PHASE_ALIGNED == task->phase) task->phase = PHASE_WANTED;
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_task_histograms(ulapi_task_struct *task, ulapi_flag on)
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+
+  if (! on) {
+    /* leave them allocated, since the task may be recording now */
+    task->histograms = 0;
+    return ULAPI_OK;
+  }
+
+  if (NULL == task->latency_hist) task->latency_hist = ulapi_histogram_new();
+  if (NULL == task->exec_hist) task->exec_hist = ulapi_histogram_new();
+  if (NULL == task->latency_hist || NULL == task->exec_hist) return ULAPI_ERROR;
+
+  /* measure execution from the next wakeup, not a stale one */
+  task->wake_ns = 0;
+  task->histograms = 1;
+
+  return ULAPI_OK;
+}
+
+void *ulapi_task_latency_histogram(ulapi_task_struct *task)
+{
+  return NULL == task ? NULL : task->latency_hist;
+}
+
+void *ulapi_task_exec_histogram(ulapi_task_struct *task)
+{
+  return NULL == task ? NULL : task->exec_hist;
+}
+
+ulapi_result ulapi_task_set_wait_mode(ulapi_task_struct *task, ulapi_integer mode)
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+  if (ULAPI_WAIT_SLEEP != mode && ULAPI_WAIT_HYBRID != mode) return ULAPI_BAD_ARGS;
+
+  task->wait_mode = mode;
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_task_set_overrun_policy(ulapi_task_struct *task, ulapi_integer policy, ulapi_integer (*code)(void *task, ulapi_int64 late_nsec))
+{
+  if (NULL == task) return ULAPI_BAD_ARGS;
+  if (policy < ULAPI_OVERRUN_CATCH_UP || policy > ULAPI_OVERRUN_CALLBACK) return ULAPI_BAD_ARGS;
+  if (ULAPI_OVERRUN_CALLBACK == policy && NULL == code) return ULAPI_BAD_ARGS;
+
+  task->overrun_policy = policy;
+  task->overrun_code = code;
+
+  return ULAPI_OK;
+}
+
+ulapi_int64 ulapi_task_overruns(ulapi_task_struct *task)
+{
+  return NULL == task ? 0 : task->overruns;
+}
+
+ulapi_int64 ulapi_task_worst_overrun(ulapi_task_struct *task)
+{
+  return NULL == task ? 0 : task->worst_overrun_ns;
+}
+
+ulapi_result ulapi_task_set_budget(ulapi_task_struct *task, ulapi_int64 budget_nsec, void (*code)(void *task, ulapi_int64 cpu_nsec))
+{
+  if (NULL == task || budget_nsec < 0) return ULAPI_BAD_ARGS;
+
+  task->budget_code = code;
+  task->budget_ns = budget_nsec;
+
+  return ULAPI_OK;
+}
+
+ulapi_result ulapi_task_cpu_stats(ulapi_task_struct *task, ulapi_int64 *min_nsec, ulapi_int64 *mean_nsec, ulapi_int64 *max_nsec, ulapi_int64 *over_budget)
+{
+  ulapi_int64 cycles;
+
+  if (NULL == task) return ULAPI_BAD_ARGS;
+
+  cycles = task->cpu_cycles;
+  if (NULL != min_nsec) *min_nsec = task->cpu_min_ns;
+  if (NULL != mean_nsec) *mean_nsec = 0 == cycles ? 0 : task->cpu_sum_ns / cycles;
+  if (NULL != max_nsec) *max_nsec = task->cpu_max_ns;
+  if (NULL != over_budget) *over_budget = task->budget_overruns;
+
+  return ULAPI_OK;
+}
+
+/* the calling thread's CPU time, which unlike the wall clock stops while it's preempted */
+static ulapi_int64 self_cpu_ns(void)
+{
+  struct timespec ts;
+
+  if (0 != clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) return 0;
+
+  return ((ulapi_int64) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* accounts for the CPU time of the cycle just ended, checking it against the budget */
+static void task_cycle_cpu(ulapi_task_struct *task)
+{
+  ulapi_int64 used;
+
+  used = self_cpu_ns() - task->wake_cpu_ns;
+  if (0 == task->cpu_cycles || used < task->cpu_min_ns) task->cpu_min_ns = used;
+  if (used > task->cpu_max_ns) task->cpu_max_ns = used;
+  task->cpu_sum_ns += used;
+  task->cpu_cycles++;
+
+  if (task->budget_ns > 0 && used > task->budget_ns) {
+    task->budget_overruns++;
+    if (NULL != task->budget_code) task->budget_code(task, used);
+  }
+}
+
+/*
+  Called when the task's next release, at its current period, had
+  already passed at 'now'. Counts the overrun and moves the release
+  according to the task's policy.
+*/
+static void task_overrun(ulapi_task_struct *task, ulapi_int64 now)
 {
-  static char ldst[] = "1970-01-01T00:00:00Z padded";
-  char *tdst = ldst;
-  size_t tsize = sizeof(ldst);
-  time_t tp;
-  struct tm *stmp;
+  ulapi_int64 late;
+  ulapi_int64 passed;
+  ulapi_integer policy;
 
-  if (-1 == time(&tp)) {
-    return NULL;
-  }
+  late = now - task->release_ns;
+  /* this release and any others since */
+  passed = late / task->period_nsec + 1;
 
-  stmp = gmtime(&tp);
-  if (NULL == stmp) {
-    return NULL;
+  if (late > task->worst_overrun_ns) task->worst_overrun_ns = late;
+
+  policy = task->overrun_policy;
+  if (ULAPI_OVERRUN_CALLBACK == policy) {
+    policy = task->overrun_code(task, late);
   }
 
-  if (NULL != dst) {
-    tdst = dst;
-    tsize = size;
+  switch (policy) {
+  case ULAPI_OVERRUN_SKIP:
+    task->overruns += passed;
+    task->release_ns += passed * task->period_nsec;
+    break;
+  case ULAPI_OVERRUN_REPHASE:
+    task->overruns += passed;
+    task->release_ns = now;
+    break;
+  default:
+    /* each late release is counted as it's run */
+    task->overruns++;
+    break;
   }
+}
 
-  if (0 == strftime(tdst, tsize, "%Y-%m-%dT%H:%M:%SZ", stmp)) {
-    return NULL;
+/*
+  Parses a CPU list like "2,3" or "2-5,7\n", as in /sys, into 'set'.
+*/
+static ulapi_result cpus_parse(const char *cpus, cpu_set_t *set)
+{
+  char *end;
+  long first, last;
+
+  CPU_ZERO(set);
+
+  while (NULL != cpus && 0 != *cpus) {
+    while (isspace(*cpus) || ',' == *cpus) cpus++;
+    if (0 == *cpus) break;
+    first = strtol(cpus, &end, 10);
+    if (end == cpus || first < 0) return ULAPI_BAD_ARGS;
+    last = first;
+    cpus = end;
+    if ('-' == *cpus) {
+      cpus++;
+      last = strtol(cpus, &end, 10);
+      if (end == cpus || last < first) return ULAPI_BAD_ARGS;
+      cpus = end;
+    }
+    if (last >= CPU_SETSIZE) return ULAPI_BAD_ARGS;
+    for (; first <= last; first++) CPU_SET(first, set);
   }
 
-  return tdst;
+  return ULAPI_OK;
 }
 
-void ulapi_sleep(ulapi_real secs)
+/* the reverse of cpus_parse, with runs written as ranges */
+static ulapi_result cpus_format(const cpu_set_t *set, char *dst, size_t size)
 {
-  int isecs, insecs;
-  struct timespec ts;
+  size_t len = 0;
+  int first, last;
+  int n;
 
-  isecs = (int) secs;
-  insecs = (int) ((secs - isecs) * 1.0e9);
+  if (NULL == dst || 0 == size) return ULAPI_BAD_ARGS;
+  *dst = 0;
 
-  ts.tv_sec = isecs;
-  ts.tv_nsec = insecs;
+  for (first = 0; first < CPU_SETSIZE; first = last + 1) {
+    if (! CPU_ISSET(first, set)) {
+      last = first;
+      continue;
+    }
+    for (last = first; last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set); last++);
+    if (first == last) n = snprintf(dst + len, size - len, "%s%d", len ? "," : "", first);
+    else n = snprintf(dst + len, size - len, "%s%d-%d", len ? "," : "", first, last);
+    if (n < 0 || (size_t) n >= size - len) return ULAPI_ERROR;
+    len += n;
+  }
 
-  (void) nanosleep(&ts, NULL);
+  return ULAPI_OK;
 }
 
-static void quit(int sig)
+static ulapi_result cpus_read(const char *path, cpu_set_t *set)
 {
-  return;
+  FILE *fp;
+  char buf[1024];
+  char *ptr;
+
+  CPU_ZERO(set);
+
+  fp = fopen(path, "r");
+  if (NULL == fp) return ULAPI_ERROR;
+  ptr = fgets(buf, sizeof(buf), fp);
+  fclose(fp);
+
+  /* an empty file means an empty list */
+  if (NULL == ptr) return ULAPI_OK;
+
+  return cpus_parse(buf, set);
 }
 
-ulapi_result ulapi_app_wait(void)
+ulapi_result ulapi_task_set_cpus(ulapi_task_struct *task, const char *cpus)
 {
-  sigset_t mask;
+  cpu_set_t set;
 
-  /* wait until ^C */
-  signal(SIGINT, quit);
-  sigemptyset(&mask);
-  sigsuspend(&mask);
+  if (NULL == task) return ULAPI_BAD_ARGS;
 
-  return ULAPI_OK;
+  if (NULL == cpus || 0 == *cpus) {
+    /* back to any CPU, which takes an explicit set if it's running */
+    (void) cpus_copy(&task->cpus, NULL);
+    (void) cpus_copy(&task->prog_cpus, NULL);
+    if (ULAPI_OK != cpus_read("/sys/devices/system/cpu/online", &set)) return ULAPI_ERROR;
+  } else {
+    if (ULAPI_OK != cpus_parse(cpus, &set) || 0 == CPU_COUNT(&set)) return ULAPI_BAD_ARGS;
+    if (ULAPI_OK != cpus_copy(&task->cpus, &set) ||
+	ULAPI_OK != cpus_copy(&task->prog_cpus, &set)) return ULAPI_ERROR;
+  }
+
+  /* tasks not running, whose threads may be gone, get it when they're started */
+  if (ULAPI_TASK_RUNNING != task->state && ULAPI_TASK_WAITING != task->state &&
+      ULAPI_TASK_PAUSED != task->state) return ULAPI_OK;
+
+  return 0 == pthread_setaffinity_np(task->tid, sizeof(set), &set) ? ULAPI_OK : ULAPI_ERROR;
 }
 
-ulapi_result ulapi_init(void)
+ulapi_result ulapi_self_set_cpus(const char *cpus)
 {
-  return ULAPI_OK;
+  cpu_set_t set;
+
+  if (NULL == cpus || 0 == *cpus) {
+    if (ULAPI_OK != cpus_read("/sys/devices/system/cpu/online", &set)) return ULAPI_ERROR;
+  } else {
+    if (ULAPI_OK != cpus_parse(cpus, &set) || 0 == CPU_COUNT(&set)) return ULAPI_BAD_ARGS;
+  }
+
+  return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set) ? ULAPI_OK : ULAPI_ERROR;
 }
 
-ulapi_result ulapi_exit(void)
+ulapi_result ulapi_cpus_isolated(char *dst, size_t size)
 {
-  return ULAPI_OK;
+  cpu_set_t set;
+
+  /* kernels without the file can't isolate CPUs this way anyway */
+  (void) cpus_read("/sys/devices/system/cpu/isolated", &set);
+
+  return cpus_format(&set, dst, size);
 }
 
-ulapi_integer ulapi_to_argv(const char *src, char ***argv)
+ulapi_result ulapi_cpus_housekeeping(char *dst, size_t size)
 {
-  char *cpy;
-  char *ptr;
-  ulapi_integer count;
-  ulapi_flag inquote;
+  cpu_set_t online, isolated, set;
 
-  *argv = NULL;
-  cpy = malloc(strlen(src) + 1);
-  count = 0;
-  inquote = 0;
+  if (ULAPI_OK != cpus_read("/sys/devices/system/cpu/online", &online)) return ULAPI_ERROR;
+  (void) cpus_read("/sys/devices/system/cpu/isolated", &isolated);
 
-  for (; ; count++) {
-    while (isspace(*src)) src++;
-    if (0 == *src) return count;
-    ptr = cpy;
-    while (0 != *src) {
-      if ('"' == *src) {
-	inquote = !inquote;
-      } else if ((!inquote) && isspace(*src)) {
-	break;
-      } else {
-	*ptr++ = *src;
-      }
-      src++;
-    }
-    *ptr++ = 0;
-    *argv = realloc(*argv, (count+1)*sizeof(**argv));
-    (*argv)[count] = malloc(strlen(cpy) + 1);
-    strcpy((*argv)[count], cpy);
-  }
-   
-  free(cpy);
+  CPU_XOR(&set, &online, &isolated);
+  CPU_AND(&set, &set, &online);
 
-  return count;
+  return cpus_format(&set, dst, size);
 }
 
-void ulapi_free_argv(ulapi_integer argc, char **argv)
+/* returns the caller's task structure, making one if it has none */
+static ulapi_task_struct *task_self_make(void)
 {
-  ulapi_integer t;
+  ulapi_task_struct *self;
 
-  for (t = 0; t < argc; t++) {
-    free((char *) argv[t]);
+  self = task_self();
+  if (NULL == self) {
+    self = calloc(1, sizeof(ulapi_task_struct));
+    if (NULL == self) return NULL;
+    self->tid = pthread_self();
+    (void) pthread_setspecific(task_key, self);
   }
-  free(argv);
 
-  return;
+  return self;
 }
 
-void ulapi_set_debug(ulapi_integer mask)
+ulapi_result ulapi_self_set_period(ulapi_integer period_nsec)
 {
-  ulapi_debug_level = mask;
+  ulapi_task_struct *self;
+
+  self = task_self_make();
+  if (NULL == self) return ULAPI_ERROR;
+
+  return ulapi_task_set_period(self, period_nsec);
 }
 
-ulapi_integer ulapi_get_debug(void)
+ulapi_result ulapi_self_set_wait_mode(ulapi_integer mode)
 {
-  return ulapi_debug_level;
+  ulapi_task_struct *self;
+
+  self = task_self_make();
+  if (NULL == self) return ULAPI_ERROR;
+
+  return ulapi_task_set_wait_mode(self, mode);
 }
 
-ulapi_prio ulapi_prio_highest(void)
+/*
+  Fibers are loops that share their scheduler's thread, each switching
+  back to the scheduler when it waits. The scheduler keeps them in a
+  heap ordered by release time, runs the earliest once it's due, and
+  sleeps until then otherwise. Their stacks are only touched as used,
+  so thousands cost little more than the memory they actually use.
+*/
+
+typedef struct fiber_struct {
+  struct fiber_sched_struct *sched;
+  void (*code)(void *);
+  void *arg;
+  ucontext_t context;
+  void *stack;			/* mapped with a guard page below */
+  size_t stack_mapped;
+  ulapi_integer period_nsec;	/* 0 means not periodic */
+  ulapi_int64 release_ns;	/* when it next runs */
+  ulapi_int64 overruns;		/* releases skipped as it ran late */
+  ulapi_flag done;		/* its code has returned */
+} fiber_struct;
+
+typedef struct fiber_sched_struct {
+  ucontext_t context;		/* the scheduler's own, switched back to */
+  fiber_struct **heap;		/* earliest release first */
+  ulapi_integer count;
+  ulapi_integer size;
+  size_t stacksize;
+  ulapi_flag running;
+} fiber_sched_struct;
+
+#define FIBER_STACK_DEFAULT (64 * 1024)
+
+/* the scheduler the calling thread is running, if any */
+static __thread fiber_sched_struct *fiber_sched_current = NULL;
+
+static void fiber_heap_push(fiber_sched_struct *s, fiber_struct *f)
 {
-  return 1;
+  ulapi_integer i, parent;
+
+  for (i = s->count++; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+    if (s->heap[parent]->release_ns <= f->release_ns) break;
+    s->heap[i] = s->heap[parent];
+  }
+  s->heap[i] = f;
 }
 
-ulapi_prio ulapi_prio_lowest(void)
+static fiber_struct *fiber_heap_pop(fiber_sched_struct *s)
 {
-  return 31;
+  fiber_struct *top, *last;
+  ulapi_integer i, child;
+
+  top = s->heap[0];
+  last = s->heap[--s->count];
+  for (i = 0; (child = 2 * i + 1) < s->count; i = child) {
+    if (child + 1 < s->count &&
+	s->heap[child + 1]->release_ns < s->heap[child]->release_ns) child++;
+    if (last->release_ns <= s->heap[child]->release_ns) break;
+    s->heap[i] = s->heap[child];
+  }
+  s->heap[i] = last;
+
+  return top;
 }
 
-ulapi_prio ulapi_prio_next_higher(ulapi_prio prio)
+static void fiber_free(fiber_struct *f)
 {
-  if (prio == ulapi_prio_highest())
-    return prio;
-
-  return prio - 1;
+  if (NULL != f->stack) (void) munmap(f->stack, f->stack_mapped);
+  free(f);
 }
 
-ulapi_prio ulapi_prio_next_lower(ulapi_prio prio)
+/* where each fiber starts, on its own stack */
+static void fiber_entry(void)
 {
-  if (prio == ulapi_prio_lowest())
-    return prio;
+  fiber_struct *f = fiber_current;
 
-  return prio + 1;
+  f->code(f->arg);
+  f->done = 1;
+  /* returning resumes the scheduler, through uc_link */
 }
 
-ulapi_result ulapi_task_init(ulapi_task_struct *task)
+/* switches from the running fiber back to the scheduler until 'release_ns' */
+static void fiber_park(ulapi_int64 release_ns)
 {
-  int policy;
-  struct sched_param sched_param;
+  fiber_struct *f = fiber_current;
 
-  if (0 != pthread_getschedparam(pthread_self(), &policy, &sched_param)) return ULAPI_ERROR;
-  if (0 != pthread_setschedparam(pthread_self(), SCHED_OTHER, &sched_param)) return ULAPI_ERROR;
-  if (0 != pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) return ULAPI_ERROR;
-  if (0 != pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL)) return ULAPI_ERROR;
-
-  return ULAPI_OK;
+  f->release_ns = release_ns;
+  (void) swapcontext(&f->context, &f->sched->context);
 }
 
-ulapi_task_struct *ulapi_task_new(void)
+void *ulapi_fiber_sched_new(size_t stacksize)
 {
-  ulapi_task_struct *ts = malloc(sizeof(ulapi_task_struct));
-  if (NULL == ts) return NULL;
+  fiber_sched_struct *s;
 
-  if (ULAPI_OK != ulapi_task_init(ts)) {
-    free(ts);
-    ts = NULL;
-  }
+  s = (fiber_sched_struct *) calloc(1, sizeof(fiber_sched_struct));
+  if (NULL == s) return NULL;
 
-  return ts;
+  s->stacksize = (0 == stacksize ? FIBER_STACK_DEFAULT : stacksize);
+
+  return s;
 }
 
-ulapi_result ulapi_task_clear(ulapi_task_struct *task)
+ulapi_result ulapi_fiber_sched_delete(void *sched)
 {
-  /* nothing need be done */
+  fiber_sched_struct *s = (fiber_sched_struct *) sched;
+  ulapi_integer i;
+
+  if (NULL == s) return ULAPI_OK;
+  if (s->running) return ULAPI_ERROR;
+
+  for (i = 0; i < s->count; i++) fiber_free(s->heap[i]);
+  free(s->heap);
+  free(s);
+
   return ULAPI_OK;
 }
 
-ulapi_result ulapi_task_delete(ulapi_task_struct *task)
+ulapi_result ulapi_fiber_add(void *sched, void (*code)(void *), void *arg, ulapi_integer period_nsec)
 {
-  if (NULL != task) {
-    (void) ulapi_task_clear(task);
-    free(task);
-  }
+  fiber_sched_struct *s = (fiber_sched_struct *) sched;
+  fiber_struct *f;
+  fiber_struct **heap;
+  size_t page, size;
 
-  return ULAPI_OK;
-}
+  if (NULL == s || NULL == code || period_nsec < 0) return ULAPI_BAD_ARGS;
+  /* the heap is the scheduler thread's alone once it's running */
+  if (s->running && fiber_sched_current != s) return ULAPI_ERROR;
 
-typedef void *(*pthread_task_code)(void *);
+  if (s->count == s->size) {
+    heap = (fiber_struct **) realloc(s->heap, (s->size + 64) * 2 * sizeof(fiber_struct *));
+    if (NULL == heap) return ULAPI_ERROR;
+    s->heap = heap;
+    s->size = (s->size + 64) * 2;
+  }
 
-ulapi_result
-ulapi_task_start(ulapi_task_struct *task,
-		 void (*taskcode)(void *),
-		 void *taskarg,
-		 ulapi_prio prio,
-		 ulapi_integer period_nsec)
-{
-  pthread_attr_t attr;
-  struct sched_param sched_param;
+  f = (fiber_struct *) calloc(1, sizeof(fiber_struct));
+  if (NULL == f) return ULAPI_ERROR;
 
-  pthread_attr_init(&attr);
-  sched_param.sched_priority = prio;
-  pthread_attr_setschedparam(&attr, &sched_param);
-  pthread_create((pthread_t *) task, &attr, (pthread_task_code) taskcode, taskarg);
+  page = (size_t) sysconf(_SC_PAGESIZE);
+  size = (s->stacksize + page - 1) / page * page;
+  f->stack = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (MAP_FAILED == f->stack) {
+    free(f);
+    return ULAPI_ERROR;
+  }
+  f->stack_mapped = size + page;
+  (void) mprotect(f->stack, page, PROT_NONE);
+
+  (void) getcontext(&f->context);
+  f->context.uc_stack.ss_sp = (char *) f->stack + page;
+  f->context.uc_stack.ss_size = size;
+  f->context.uc_link = &s->context;
+  makecontext(&f->context, fiber_entry, 0);
+
+  f->sched = s;
+  f->code = code;
+  f->arg = arg;
+  f->period_nsec = period_nsec;
+  /* due at once, and phased from then if periodic */
+  f->release_ns = ulapi_time_ns();
+  fiber_heap_push(s, f);
 
   return ULAPI_OK;
 }
 
-ulapi_result ulapi_task_stop(ulapi_task_struct *task)
+static void fiber_sched_done(void *arg)
 {
-  return (pthread_cancel(*((ulapi_task_struct *) task)) == 0 ? ULAPI_OK : ULAPI_ERROR);
-}
+  fiber_sched_struct *s = (fiber_sched_struct *) arg;
 
-ulapi_result ulapi_task_pause(ulapi_task_struct *task)
-{
-  return ULAPI_OK;
+  s->running = 0;
+  fiber_sched_current = NULL;
+  fiber_current = NULL;
 }
 
-ulapi_result ulapi_task_resume(ulapi_task_struct *task)
+void ulapi_fiber_run(void *sched)
 {
-  return ULAPI_OK;
+  fiber_sched_struct *s = (fiber_sched_struct *) sched;
+  ulapi_task_struct *self;
+  fiber_struct *f;
+
+  if (NULL == s || s->running) return;
+
+  self = task_self();
+  s->running = 1;
+  fiber_sched_current = s;
+  /* a stopped task ends here, leaving the fibers for the delete */
+  pthread_cleanup_push(fiber_sched_done, s);
+
+  while (s->count > 0) {
+    if (NULL != self) task_stop_check(self);
+
+    f = s->heap[0];
+    if (f->release_ns > ulapi_time_ns()) {
+      if (NULL != self) self->state = ULAPI_TASK_WAITING;
+      sleep_until(f->release_ns);
+      if (NULL != self) {
+	task_stop_check(self);
+	task_woke(self);
+      }
+      continue;
+    }
+
+    f = fiber_heap_pop(s);
+    fiber_current = f;
+    (void) swapcontext(&s->context, &f->context);
+    fiber_current = NULL;
+
+    if (f->done) fiber_free(f);
+    else fiber_heap_push(s, f);
+  }
+
+  pthread_cleanup_pop(1);
 }
 
-ulapi_result ulapi_task_set_period(ulapi_task_struct *task, ulapi_integer period_nsec)
+ulapi_int64 ulapi_fiber_overruns(void)
 {
-  return ULAPI_OK;
+  return NULL == fiber_current ? 0 : fiber_current->overruns;
 }
 
-ulapi_result ulapi_self_set_period(ulapi_integer period_nsec)
+/* ulapi_wait for fibers, which can't block their thread */
+static void fiber_wait(ulapi_integer period_nsec)
 {
-  return ULAPI_OK;
+  fiber_struct *f = fiber_current;
+  ulapi_int64 now;
+  ulapi_int64 release;
+
+  now = ulapi_time_ns();
+
+  if (0 == f->period_nsec) {
+    fiber_park(now + period_nsec);
+    return;
+  }
+
+  /*
+    The next release, or if it's a whole period late already, the
+    next one still to come, so a late fiber doesn't run a burst of
+    cycles to catch up. It stays in phase either way.
+  */
+  release = f->release_ns + f->period_nsec;
+  if (now - release >= f->period_nsec) {
+    f->overruns += (now - release) / f->period_nsec;
+    release += (now - release) / f->period_nsec * f->period_nsec;
+  }
+  fiber_park(release);
 }
 
 ulapi_result ulapi_wait(ulapi_integer period_nsec)
 {
-  struct timespec ts;
+  ulapi_task_struct *self;
+  ulapi_flag hybrid;
+  ulapi_int64 now;
+  ulapi_int64 wake;
 
-  if (period_nsec < _ulapi_wait_offset_nsec + 1) period_nsec = 1;
-  else period_nsec -= _ulapi_wait_offset_nsec;
+  if (NULL != fiber_current) {
+    fiber_wait(period_nsec);
+    return ULAPI_OK;
+  }
 
-  ts.tv_sec = 0;
-  ts.tv_nsec = period_nsec;
+  self = task_self();
+  /* a stopped task goes no further than its next wait */
+  if (NULL != self) task_stop_check(self);
+  hybrid = (NULL != self && ULAPI_WAIT_HYBRID == self->wait_mode);
+#ifdef ULAPI_SIM
+  /* spinning would never see virtual time move */
+  hybrid = 0;
+#endif
 
-  (void) nanosleep(&ts, NULL);
+  if (hybrid) wait_ready();
+  if (hybrid && ! self->slack_cut) {
+    timer_slack_cut();
+    self->slack_cut = 1;
+  }
+
+  if (NULL != self && self->next_period_nsec > 0) {
+    if (0 == self->period_nsec) {
+      /* just made periodic, so phase the releases from now */
+      self->release_ns = ulapi_time_ns();
+      self->period_nsec = self->next_period_nsec;
+    }
+    /*
+      Advance the release by exactly one period, regardless of how
+      long the work took. A newly set period applies from this
+      release on.
+    */
+    now = ulapi_time_ns();
+    if (0 != self->wake_ns) task_cycle_cpu(self);
+    if (self->histograms && 0 != self->wake_ns) {
+      ulapi_histogram_record(self->exec_hist, now - self->wake_ns);
+    }
+    if (task_park(self)) {
+      /* back on its schedule, from the last release it slept through */
+      now = ulapi_time_ns();
+      if (now > self->release_ns) {
+	self->release_ns += (now - self->release_ns) / self->period_nsec * self->period_nsec;
+      }
+    }
+    self->release_ns += self->period_nsec;
+    self->period_nsec = self->next_period_nsec;
+    if (PHASE_WANTED == self->phase) task_phase_align(self, now);
+    if (now > self->release_ns) task_overrun(self, now);
+    self->state = ULAPI_TASK_WAITING;
+    wake = wait_until(self->release_ns, hybrid);
+    task_stop_check(self);
+    task_woke(self);
+    self->wake_ns = wake;
+    self->wake_cpu_ns = self_cpu_ns();
+    if (self->histograms) {
+      ulapi_histogram_record(self->latency_hist, wake - self->release_ns);
+    }
+    return ULAPI_OK;
+  }
+
+  if (NULL != self) {
+    self->period_nsec = 0;
+    (void) task_park(self);
+    self->state = ULAPI_TASK_WAITING;
+  }
+
+  if (hybrid) {
+    (void) wait_until(ulapi_time_ns() + period_nsec, 1);
+  } else {
+#ifdef ULAPI_SIM
+    sim_sleep_until(ulapi_time_ns() + period_nsec, NULL == self ? NULL : &self->stop);
+#else
+    ulapi_int64 nsec;
+    struct timespec ts;
+
+    /* wake up on time on average, by sleeping less the mean oversleep */
+    wait_ready();
+    nsec = period_nsec - (_ulapi_oversleep_mean8 >> 3);
+    if (nsec < 1) nsec = 1;
+
+    ts.tv_sec = nsec / NSEC_PER_SEC;
+    ts.tv_nsec = nsec % NSEC_PER_SEC;
+
+    if (NULL != self) {
+      sleep_until(ulapi_time_ns() + nsec);
+    } else {
+      (void) nanosleep(&ts, NULL);
+    }
+#endif
+  }
+
+  if (NULL != self) {
+    task_stop_check(self);
+    task_woke(self);
+  }
 
   return ULAPI_OK;
 }
@@ -417,14 +2894,21 @@ void ulapi_task_exit(ulapi_integer retval)
 
 ulapi_result ulapi_task_join(ulapi_task_struct *task, ulapi_integer *retptr)
 {
-  ulapi_integer retval;
+  void *retval;			/* pointer-sized, as pthread_join writes */
   int ret;
 
-  ret = pthread_join(*((ulapi_task_struct *) task), (void **) &retval);
+#ifdef ULAPI_SIM
+  sim_block(1);
+  ret = pthread_join(task->tid, &retval);
+  sim_block(0);
+#else
+  ret = pthread_join(task->tid, &retval);
+#endif
 
   if (0 == ret) {
     if (NULL != retptr) {
-      *retptr = retval;
+      /* the reverse of ulapi_task_exit, and -1 if it was stopped */
+      *retptr = (ulapi_integer) (ptrdiff_t) retval;
     }
     return ULAPI_OK;
   }
@@ -432,6 +2916,37 @@ ulapi_result ulapi_task_join(ulapi_task_struct *task, ulapi_integer *retptr)
   return ULAPI_ERROR;
 }
 
+ulapi_result ulapi_task_join_timeout(ulapi_task_struct *task, ulapi_int64 timeout_nsec, ulapi_integer *retptr)
+{
+  void *retval;
+  struct timespec ts;
+  ulapi_int64 ns;
+  int ret;
+
+  if (NULL == task || timeout_nsec < 0) return ULAPI_BAD_ARGS;
+
+  /* pthread_timedjoin_np takes an absolute real time */
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ns = (ulapi_int64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec + timeout_nsec;
+  ts.tv_sec = ns / NSEC_PER_SEC;
+  ts.tv_nsec = ns % NSEC_PER_SEC;
+
+#ifdef ULAPI_SIM
+  sim_block(1);
+  ret = pthread_timedjoin_np(task->tid, &retval, &ts);
+  sim_block(0);
+#else
+  ret = pthread_timedjoin_np(task->tid, &retval, &ts);
+#endif
+
+  if (0 == ret) {
+    if (NULL != retptr) *retptr = (ulapi_integer) (ptrdiff_t) retval;
+    return ULAPI_OK;
+  }
+
+  return ULAPI_ERROR;
+}
+
 ulapi_integer ulapi_task_id(void)
 {
   return (ulapi_integer) pthread_self();
@@ -900,16 +3415,17 @@ typedef struct {
   void * addr;
 } shm_struct;
 
-void * ulapi_shm_new(ulapi_id key, ulapi_integer size)
+static void * shm_get(ulapi_id key, ulapi_integer size, int flags)
 {
   shm_struct * shm;
 
   shm = malloc(sizeof(shm_struct));
   if (NULL == (void *) shm) return NULL;
 
-  shm->id = shmget((key_t) key, (int) size, IPC_CREAT | 0666);
+  shm->id = shmget((key_t) key, (int) size, flags);
   if (-1 == shm->id) {
-    PERROR("shmget");
+    /* not there to attach to is for the caller to report */
+    if (ENOENT != errno) PERROR("shmget");
     free(shm);
     return NULL;
   }
@@ -924,6 +3440,16 @@ void * ulapi_shm_new(ulapi_id key, ulapi_integer size)
   return (void *) shm;
 }
 
+void * ulapi_shm_new(ulapi_id key, ulapi_integer size)
+{
+  return shm_get(key, size, IPC_CREAT | 0666);
+}
+
+void * ulapi_shm_attach(ulapi_id key, ulapi_integer size)
+{
+  return shm_get(key, size, 0);
+}
+
 void * ulapi_shm_addr(void * shm)
 {
   return ((shm_struct *) shm)->addr;
@@ -185,6 +185,11 @@ rtapi_result rtapi_clock_get_time(rtapi_integer *secs,
   return RTAPI_OK;
 }
 
+rtapi_int64 rtapi_clock_get_ns(void)
+{
+  return ulapi_time_ns();
+}
+
 rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs, 
 				      rtapi_integer start_nsecs,
 				      rtapi_integer end_secs, 
@@ -192,27 +197,14 @@ rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs,
 				      rtapi_integer *diff_secs, 
 				      rtapi_integer *diff_nsecs)
 {
-  if (end_nsecs < start_nsecs) {
-    if (end_secs < start_secs) {
-      /* 1.1 - 9.9 */
-      *diff_nsecs = start_nsecs - end_nsecs;
-      *diff_secs = start_secs - end_secs;
-    } else {
-      /* 9.1 - 1.9 */
-      *diff_nsecs = 1000000000 - start_nsecs + end_nsecs;
-      *diff_secs = end_secs - start_secs - 1;
-    }
-  } else {
-    if (end_secs < start_secs) {
-      /* 1.9 - 9.1 */
-      *diff_nsecs = 1000000000 - end_nsecs + start_nsecs;
-      *diff_secs = start_secs - end_secs - 1;
-    } else {
-      /* 9.9 - 1.1 */
-      *diff_nsecs = end_nsecs - start_nsecs;
-      *diff_secs = end_secs - start_secs;
-    }
-  }
+  rtapi_int64 diff;
+
+  diff = ((rtapi_int64) end_secs - start_secs) * 1000000000 +
+    ((rtapi_int64) end_nsecs - start_nsecs);
+  if (diff < 0) diff = -diff;
+
+  *diff_secs = (rtapi_integer) (diff / 1000000000);
+  *diff_nsecs = (rtapi_integer) (diff % 1000000000);
 
   return RTAPI_OK;
 }
@@ -273,6 +265,30 @@ rtapi_task_set_period(rtapi_task_struct *task, rtapi_integer period_nsec)
   return ulapi_task_set_period(task, period_nsec);
 }
 
+rtapi_result
+rtapi_task_set_cpus(rtapi_task_struct *task, const char *cpus)
+{
+  return ulapi_task_set_cpus(task, cpus);
+}
+
+rtapi_result
+rtapi_task_set_name(rtapi_task_struct *task, const char *name)
+{
+  return ulapi_task_set_name(task, name);
+}
+
+rtapi_result
+rtapi_timebase_publish(rtapi_int64 base_period_nsec)
+{
+  return ulapi_timebase_publish(base_period_nsec);
+}
+
+rtapi_result
+rtapi_task_set_phase(rtapi_task_struct *task, rtapi_int64 offset_nsec)
+{
+  return ulapi_task_set_phase(task, offset_nsec);
+}
+
 rtapi_result
 rtapi_self_set_period(rtapi_integer period_nsec)
 {
@@ -298,6 +314,12 @@ rtapi_task_stack_check(rtapi_task_struct *task)
   return -1;			/* irrelevant on this platform */
 }
 
+rtapi_integer
+rtapi_task_overruns(rtapi_task_struct *task)
+{
+  return -1;			/* tasks aren't released periodically here */
+}
+
 void *rtapi_shm_new(rtapi_id key, rtapi_integer size)
 {
   return ulapi_shm_new(key, size);
@@ -76,6 +76,19 @@ ulapi_result ulapi_init(void)
   return ULAPI_OK;
 }
 
+ulapi_result ulapi_init_profile(ulapi_integer profile)
+{
+  if (ULAPI_PROFILE_RT == profile) return ULAPI_IMPL_ERROR;
+  if (profile < ULAPI_PROFILE_DEFAULT || profile > ULAPI_PROFILE_RT) return ULAPI_BAD_ARGS;
+
+  return ulapi_init();
+}
+
+ulapi_integer ulapi_get_profile(void)
+{
+  return ULAPI_PROFILE_NORMAL;
+}
+
 ulapi_result ulapi_exit(void)
 {
   return ULAPI_OK;
@@ -160,6 +173,52 @@ ulapi_real ulapi_time(void)
   return (ulapi_real) (((double) tv.tv_sec) + ((double) tv.tv_usec) * 1.0e-6);
 }
 
+ulapi_int64 ulapi_time_ns(void)
+{
+  static LARGE_INTEGER freq = {0};
+  LARGE_INTEGER t;
+
+  if (0 == freq.QuadPart) {
+    if (! QueryPerformanceFrequency(&freq)) freq.QuadPart = 1;
+  }
+  QueryPerformanceCounter(&t);
+
+  /* split the conversion so the product doesn't overflow */
+  return (t.QuadPart / freq.QuadPart) * 1000000000 +
+    ((t.QuadPart % freq.QuadPart) * 1000000000) / freq.QuadPart;
+}
+
+/*
+  The performance counter is Windows' invariant cycle counter, so
+  ulapi_cycles reads it raw and converts only when asked.
+*/
+
+ulapi_result ulapi_cycles_init(void)
+{
+  return ULAPI_OK;
+}
+
+ulapi_int64 ulapi_cycles(void)
+{
+  LARGE_INTEGER t;
+
+  QueryPerformanceCounter(&t);
+
+  return t.QuadPart;
+}
+
+ulapi_int64 ulapi_cycles_to_ns(ulapi_int64 cycles)
+{
+  static LARGE_INTEGER freq = {0};
+
+  if (0 == freq.QuadPart) {
+    if (! QueryPerformanceFrequency(&freq)) freq.QuadPart = 1;
+  }
+
+  return (cycles / freq.QuadPart) * 1000000000 +
+    ((cycles % freq.QuadPart) * 1000000000) / freq.QuadPart;
+}
+
 const char *ulapi_time_string(char *dst, size_t size)
 {
   static char ldst[] = "1970-01-01T00:00:00Z padded";
@@ -189,6 +248,12 @@ const char *ulapi_time_string(char *dst, size_t size)
   return tdst;
 }
 
+/* not yet, as there's no gmtime_r or sub-second wall clock here */
+const char *ulapi_time_string_precise(char *dst, size_t size, ulapi_integer digits)
+{
+  return ULAPI_TIME_SEC == digits ? ulapi_time_string(dst, size) : NULL;
+}
+
 void ulapi_sleep(ulapi_real secs)
 {
   DWORD dwMilliseconds;
@@ -466,6 +531,263 @@ ulapi_result ulapi_wait(ulapi_integer period_nsec)
   return ULAPI_OK;
 }
 
+ulapi_result ulapi_task_histograms(ulapi_task_struct *task, ulapi_flag on)
+{
+  /* tasks here aren't released periodically, so there is nothing to record */
+  return ULAPI_IMPL_ERROR;
+}
+
+void *ulapi_task_latency_histogram(ulapi_task_struct *task)
+{
+  return NULL;
+}
+
+void *ulapi_task_exec_histogram(ulapi_task_struct *task)
+{
+  return NULL;
+}
+
+/*
+  The timer service is built on Linux timerfds, so isn't here yet.
+*/
+
+void *ulapi_timer_new(void (*code)(void *arg), void *arg)
+{
+  return NULL;
+}
+
+ulapi_result ulapi_timer_arm(void *timer, ulapi_int64 delay_nsec, ulapi_int64 period_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_timer_cancel(void *timer)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_timer_delete(void *timer)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+/*
+  Nor is the thread pool, whose queues are built on pthreads.
+*/
+
+void *ulapi_pool_new(ulapi_integer workers, ulapi_prio prio, const char *cpus)
+{
+  return NULL;
+}
+
+ulapi_result ulapi_pool_delete(void *pool)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_pool_submit(void *pool, void *group, void (*code)(void *arg), void *arg)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+void *ulapi_pool_group_new(void)
+{
+  return NULL;
+}
+
+ulapi_result ulapi_pool_group_wait(void *pool, void *group)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_pool_group_delete(void *group)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_overrun_policy(ulapi_task_struct *task, ulapi_integer policy, ulapi_integer (*code)(void *task, ulapi_int64 late_nsec))
+{
+  /* tasks here aren't released periodically, so they never overrun */
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_int64 ulapi_task_overruns(ulapi_task_struct *task)
+{
+  return 0;
+}
+
+ulapi_int64 ulapi_task_worst_overrun(ulapi_task_struct *task)
+{
+  return 0;
+}
+
+ulapi_result ulapi_task_set_cpus(ulapi_task_struct *task, const char *cpus)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_self_set_cpus(const char *cpus)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_cpus_isolated(char *dst, size_t size)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_cpus_housekeeping(char *dst, size_t size)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_stacksize(ulapi_task_struct *task, size_t stacksize)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_integer ulapi_task_stack_check(ulapi_task_struct *task)
+{
+  return -1;			/* stacks aren't painted here */
+}
+
+ulapi_result ulapi_task_set_phase(ulapi_task_struct *task, ulapi_int64 offset_nsec)
+{
+  /* tasks here aren't released periodically, so have no phase */
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_cpu_latency_set(ulapi_integer usec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_cpu_governor(ulapi_integer cpu, char *dst, size_t size)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_name(ulapi_task_struct *task, const char *name)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_integer ulapi_task_list(ulapi_task_info *info, ulapi_integer max)
+{
+  return 0;
+}
+
+ulapi_result ulapi_task_registry_export(ulapi_id key, ulapi_int64 period_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_flag ulapi_self_stop_requested(void)
+{
+  return 0;
+}
+
+ulapi_result ulapi_task_kill(ulapi_task_struct *task)
+{
+  return (0 != TerminateThread(task->hThread, (DWORD) -1) ? ULAPI_OK : ULAPI_ERROR);
+}
+
+ulapi_result ulapi_task_join_timeout(ulapi_task_struct *task, ulapi_int64 timeout_nsec, ulapi_integer *retptr)
+{
+  DWORD dw;
+
+  dw = WaitForSingleObject(task->hThread, (DWORD) (timeout_nsec / 1000000));
+  if (WAIT_OBJECT_0 != dw) return ULAPI_ERROR;
+
+  return ulapi_task_join(task, retptr);
+}
+
+void *ulapi_fiber_sched_new(size_t stacksize)
+{
+  return NULL;
+}
+
+ulapi_result ulapi_fiber_sched_delete(void *sched)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_fiber_add(void *sched, void (*code)(void *), void *arg, ulapi_integer period_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+void ulapi_fiber_run(void *sched)
+{
+  return;
+}
+
+ulapi_int64 ulapi_fiber_overruns(void)
+{
+  return 0;
+}
+
+ulapi_result ulapi_admission_set(ulapi_integer mode)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_wcet(ulapi_task_struct *task, ulapi_int64 wcet_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_admission_check(ulapi_integer cpu)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_budget(ulapi_task_struct *task, ulapi_int64 budget_nsec, void (*code)(void *task, ulapi_int64 cpu_nsec))
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_cpu_stats(ulapi_task_struct *task, ulapi_int64 *min_nsec, ulapi_int64 *mean_nsec, ulapi_int64 *max_nsec, ulapi_int64 *over_budget)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_restart(ulapi_task_struct *task, ulapi_int64 timeout_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_policy(ulapi_task_struct *task, ulapi_integer policy)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_config(const char *path)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_wait_mode(ulapi_task_struct *task, ulapi_integer mode)
+{
+  /* only plain sleeps here */
+  return ULAPI_WAIT_SLEEP == mode ? ULAPI_OK : ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_self_set_wait_mode(ulapi_integer mode)
+{
+  return ULAPI_WAIT_SLEEP == mode ? ULAPI_OK : ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_wait_guard_set(ulapi_integer guard_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_integer ulapi_wait_guard_get(void)
+{
+  return 0;
+}
+
 void ulapi_task_exit(ulapi_integer retval)
 {
   ExitThread(retval);
@@ -1010,6 +1332,39 @@ void *ulapi_shm_new(ulapi_id key, ulapi_integer size)
   return shm;
 }
 
+void *ulapi_shm_attach(ulapi_id key, ulapi_integer size)
+{
+  win32_shm_struct * shm;
+  HANDLE hMapFile;
+  void *ptr;
+
+  shm = (win32_shm_struct *) malloc(sizeof(win32_shm_struct));
+  if (NULL == shm) {
+    return NULL;
+  }
+
+  ulapi_snprintf(ulapi_shm_name, sizeof(ulapi_shm_name), "shm%d", (int) key);
+  ulapi_shm_name[sizeof(ulapi_shm_name)-1] = 0;
+
+  hMapFile = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, ulapi_shm_name);
+  if (hMapFile == NULL) {
+    free(shm);
+    return NULL;
+  }
+
+  ptr = MapViewOfFile(hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (ptr == NULL) {
+    CloseHandle(hMapFile);
+    free(shm);
+    return NULL;
+  }
+
+  shm->hMapFile = hMapFile;
+  shm->ptr = ptr;
+
+  return shm;
+}
+
 void *ulapi_shm_addr(void *shm)
 {
   if (NULL == shm) return NULL;
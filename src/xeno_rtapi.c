@@ -114,6 +114,11 @@ rtapi_result rtapi_clock_get_time(rtapi_integer *secs, rtapi_integer *nsecs)
   return RTAPI_OK;
 }
 
+rtapi_int64 rtapi_clock_get_ns(void)
+{
+  return (rtapi_int64) rt_timer_ticks2ns(rt_timer_read());
+}
+
 rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs,
 				      rtapi_integer start_nsecs,
 				      rtapi_integer end_secs,
@@ -121,27 +126,14 @@ rtapi_result rtapi_clock_get_interval(rtapi_integer start_secs,
 				      rtapi_integer *diff_secs,
 				      rtapi_integer *diff_nsecs)
 {
-  if (end_nsecs < start_nsecs) {
-    if (end_secs < start_secs) {
-      /* 1.1 - 9.9 */
-      *diff_nsecs = start_nsecs - end_nsecs;
-      *diff_secs = start_secs - end_secs;
-    } else {
-      /* 9.1 - 1.9 */
-      *diff_nsecs = 1000000000 - start_nsecs + end_nsecs;
-      *diff_secs = end_secs - start_secs - 1;
-    }
-  } else {
-    if (end_secs < start_secs) {
-      /* 1.9 - 9.1 */
-      *diff_nsecs = 1000000000 - end_nsecs + start_nsecs;
-      *diff_secs = start_secs - end_secs - 1;
-    } else {
-      /* 9.9 - 1.1 */
-      *diff_nsecs = end_nsecs - start_nsecs;
-      *diff_secs = end_secs - start_secs;
-    }
-  }
+  rtapi_int64 diff;
+
+  diff = ((rtapi_int64) end_secs - start_secs) * 1000000000 +
+    ((rtapi_int64) end_nsecs - start_nsecs);
+  if (diff < 0) diff = -diff;
+
+  *diff_secs = (rtapi_integer) (diff / 1000000000);
+  *diff_nsecs = (rtapi_integer) (diff % 1000000000);
 
   return RTAPI_OK;
 }
@@ -173,6 +165,11 @@ rtapi_integer rtapi_task_stack_check(rtapi_task_struct *task)
   return -1;
 }
 
+rtapi_integer rtapi_task_overruns(rtapi_task_struct *task)
+{
+  return -1;			/* Xenomai reports them to rt_task_wait_period only */
+}
+
 rtapi_result rtapi_task_start(rtapi_task_struct *task,
 			      void (*taskcode)(void *),
 			      void *taskarg,
@@ -221,6 +218,28 @@ rtapi_result rtapi_task_resume(rtapi_task_struct *task)
   return (rt_task_resume(task) == 0) ? (RTAPI_OK) : (RTAPI_ERROR);
 }
 
+rtapi_result rtapi_task_set_cpus(rtapi_task_struct *task, const char *cpus)
+{
+  /* Xenomai fixes the CPU when the task is created */
+  return RTAPI_IMPL_ERROR;
+}
+
+rtapi_result rtapi_task_set_name(rtapi_task_struct *task, const char *name)
+{
+  /* and the name, too */
+  return RTAPI_IMPL_ERROR;
+}
+
+rtapi_result rtapi_timebase_publish(rtapi_int64 base_period_nsec)
+{
+  return RTAPI_IMPL_ERROR;
+}
+
+rtapi_result rtapi_task_set_phase(rtapi_task_struct *task, rtapi_int64 offset_nsec)
+{
+  return RTAPI_IMPL_ERROR;
+}
+
 rtapi_result rtapi_task_set_period(rtapi_task_struct *task, rtapi_integer period_nsec)
 {
   rt_task_set_periodic(NULL, TM_NOW, period_nsec);
@@ -151,35 +151,93 @@ ulapi_real ulapi_time(void)
 #endif
 }
 
-const char *ulapi_time_string(char *dst, size_t size)
+ulapi_int64 ulapi_time_ns(void)
 {
-  static char ldst[] = "1970-01-01T00:00:00Z padded";
-  char *tdst = ldst;
-  size_t tsize = sizeof(ldst);
-  time_t tp;
-  struct tm *stmp;
+  struct timespec ts;
 
-  if (-1 == time(&tp)) {
-    return NULL;
-  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
 
-  stmp = gmtime(&tp);
-  if (NULL == stmp) {
-    return NULL;
-  }
+  return ((ulapi_int64) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* no cycle counter here, so use the nanosecond clock */
+
+ulapi_result ulapi_cycles_init(void)
+{
+  return ULAPI_OK;
+}
+
+ulapi_int64 ulapi_cycles(void)
+{
+  return ulapi_time_ns();
+}
+
+ulapi_int64 ulapi_cycles_to_ns(ulapi_int64 cycles)
+{
+  return cycles;
+}
+
+/*
+  The date and time to the second, kept for each thread so that
+  stamping many log lines in the same second formats it only once.
+*/
+static __thread time_t ts_cached_sec = -1;
+static __thread char ts_cached_prefix[sizeof("1970-01-01T00:00:00")];
+static __thread char ts_ldst[sizeof("1970-01-01T00:00:00.000000000Z padded")];
+
+const char *ulapi_time_string_precise(char *dst, size_t size, ulapi_integer digits)
+{
+  struct timespec ts;
+  struct tm stm;
+  char *tdst = ts_ldst;
+  size_t tsize = sizeof(ts_ldst);
+  size_t len;
+  long frac;
+  int i;
+
+  if (digits < 0 || digits > 9) return NULL;
 
   if (NULL != dst) {
     tdst = dst;
     tsize = size;
   }
 
-  if (0 == strftime(tdst, tsize, "%Y-%m-%dT%H:%M:%SZ", stmp)) {
-    return NULL;
+  if (0 != clock_gettime(CLOCK_REALTIME, &ts)) return NULL;
+
+  if (ts.tv_sec != ts_cached_sec) {
+    if (NULL == gmtime_r(&ts.tv_sec, &stm)) return NULL;
+    if (0 == strftime(ts_cached_prefix, sizeof(ts_cached_prefix), "%Y-%m-%dT%H:%M:%S", &stm)) {
+      return NULL;
+    }
+    ts_cached_sec = ts.tv_sec;
+  }
+
+  /* the prefix, the point and digits if any, the Z and the null */
+  len = sizeof(ts_cached_prefix) - 1;
+  if (tsize < len + (digits > 0 ? digits + 1 : 0) + 2) return NULL;
+
+  memcpy(tdst, ts_cached_prefix, len);
+  if (digits > 0) {
+    frac = ts.tv_nsec;
+    for (i = digits; i < 9; i++) frac /= 10;
+    tdst[len] = '.';
+    for (i = digits; i > 0; i--) {
+      tdst[len + i] = (char) ('0' + frac % 10);
+      frac /= 10;
+    }
+    len += digits + 1;
   }
+  tdst[len] = 'Z';
+  tdst[len + 1] = 0;
 
   return tdst;
 }
 
+const char *ulapi_time_string(char *dst, size_t size)
+{
+  return ulapi_time_string_precise(dst, size, ULAPI_TIME_SEC);
+}
+
 void ulapi_sleep(ulapi_real secs)
 {
   int isecs, insecs;
@@ -216,6 +274,19 @@ ulapi_result ulapi_init(void)
   return ULAPI_OK;
 }
 
+ulapi_result ulapi_init_profile(ulapi_integer profile)
+{
+  /* Xenomai tasks are always real-time, so the profile changes nothing */
+  if (profile < ULAPI_PROFILE_DEFAULT || profile > ULAPI_PROFILE_RT) return ULAPI_BAD_ARGS;
+
+  return ulapi_init();
+}
+
+ulapi_integer ulapi_get_profile(void)
+{
+  return ULAPI_PROFILE_RT;
+}
+
 ulapi_result ulapi_exit(void)
 {
   return ULAPI_OK;
@@ -314,7 +385,8 @@ ulapi_result ulapi_task_init(ulapi_task_struct *task)
   if (0 != pthread_getschedparam(pthread_self(), &policy, &sched_param)) return ULAPI_ERROR;
   if (0 != pthread_setschedparam(pthread_self(), SCHED_OTHER, &sched_param)) return ULAPI_ERROR;
   if (0 != pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) return ULAPI_ERROR;
-  if (0 != pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL)) return ULAPI_ERROR;
+  /* only at cancellation points, not partway through an update */
+  if (0 != pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL)) return ULAPI_ERROR;
 
   return ULAPI_OK;
 }
@@ -363,14 +435,16 @@ ulapi_task_start(ulapi_task_struct *task,
   pthread_attr_init(&attr);
   sched_param.sched_priority = prio;
   pthread_attr_setschedparam(&attr, &sched_param);
-  pthread_create((pthread_t *) task, &attr, (pthread_task_code) taskcode, taskarg);
+  task->taskcode = taskcode;
+  task->taskarg = taskarg;
+  pthread_create(&task->tid, &attr, (pthread_task_code) taskcode, taskarg);
 
   return ULAPI_OK;
 }
 
 ulapi_result ulapi_task_stop(ulapi_task_struct *task)
 {
-  return (pthread_cancel(*((ulapi_task_struct *) task)) == 0 ? ULAPI_OK : ULAPI_ERROR);
+  return (pthread_cancel(task->tid) == 0 ? ULAPI_OK : ULAPI_ERROR);
 }
 
 ulapi_result ulapi_task_pause(ulapi_task_struct *task)
@@ -408,6 +482,200 @@ ulapi_result ulapi_wait(ulapi_integer period_nsec)
   return ULAPI_OK;
 }
 
+ulapi_result ulapi_task_histograms(ulapi_task_struct *task, ulapi_flag on)
+{
+  /* tasks here aren't released periodically, so there is nothing to record */
+  return ULAPI_IMPL_ERROR;
+}
+
+void *ulapi_task_latency_histogram(ulapi_task_struct *task)
+{
+  return NULL;
+}
+
+void *ulapi_task_exec_histogram(ulapi_task_struct *task)
+{
+  return NULL;
+}
+
+ulapi_result ulapi_task_set_overrun_policy(ulapi_task_struct *task, ulapi_integer policy, ulapi_integer (*code)(void *task, ulapi_int64 late_nsec))
+{
+  /* tasks here aren't released periodically, so they never overrun */
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_int64 ulapi_task_overruns(ulapi_task_struct *task)
+{
+  return 0;
+}
+
+ulapi_int64 ulapi_task_worst_overrun(ulapi_task_struct *task)
+{
+  return 0;
+}
+
+ulapi_result ulapi_task_set_cpus(ulapi_task_struct *task, const char *cpus)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_self_set_cpus(const char *cpus)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_cpus_isolated(char *dst, size_t size)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_cpus_housekeeping(char *dst, size_t size)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_stacksize(ulapi_task_struct *task, size_t stacksize)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_integer ulapi_task_stack_check(ulapi_task_struct *task)
+{
+  return -1;			/* stacks aren't painted here */
+}
+
+ulapi_result ulapi_task_set_phase(ulapi_task_struct *task, ulapi_int64 offset_nsec)
+{
+  /* tasks here aren't released periodically, so have no phase */
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_cpu_latency_set(ulapi_integer usec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_cpu_governor(ulapi_integer cpu, char *dst, size_t size)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_name(ulapi_task_struct *task, const char *name)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_integer ulapi_task_list(ulapi_task_info *info, ulapi_integer max)
+{
+  return 0;
+}
+
+ulapi_result ulapi_task_registry_export(ulapi_id key, ulapi_int64 period_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_flag ulapi_self_stop_requested(void)
+{
+  return 0;
+}
+
+ulapi_result ulapi_task_kill(ulapi_task_struct *task)
+{
+  return ulapi_task_stop(task);
+}
+
+ulapi_result ulapi_task_join_timeout(ulapi_task_struct *task, ulapi_int64 timeout_nsec, ulapi_integer *retptr)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+void *ulapi_fiber_sched_new(size_t stacksize)
+{
+  return NULL;
+}
+
+ulapi_result ulapi_fiber_sched_delete(void *sched)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_fiber_add(void *sched, void (*code)(void *), void *arg, ulapi_integer period_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+void ulapi_fiber_run(void *sched)
+{
+  return;
+}
+
+ulapi_int64 ulapi_fiber_overruns(void)
+{
+  return 0;
+}
+
+ulapi_result ulapi_admission_set(ulapi_integer mode)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_wcet(ulapi_task_struct *task, ulapi_int64 wcet_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_admission_check(ulapi_integer cpu)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_budget(ulapi_task_struct *task, ulapi_int64 budget_nsec, void (*code)(void *task, ulapi_int64 cpu_nsec))
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_cpu_stats(ulapi_task_struct *task, ulapi_int64 *min_nsec, ulapi_int64 *mean_nsec, ulapi_int64 *max_nsec, ulapi_int64 *over_budget)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_restart(ulapi_task_struct *task, ulapi_int64 timeout_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_policy(ulapi_task_struct *task, ulapi_integer policy)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_config(const char *path)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_task_set_wait_mode(ulapi_task_struct *task, ulapi_integer mode)
+{
+  /* only plain sleeps here */
+  return ULAPI_WAIT_SLEEP == mode ? ULAPI_OK : ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_self_set_wait_mode(ulapi_integer mode)
+{
+  return ULAPI_WAIT_SLEEP == mode ? ULAPI_OK : ULAPI_IMPL_ERROR;
+}
+
+ulapi_result ulapi_wait_guard_set(ulapi_integer guard_nsec)
+{
+  return ULAPI_IMPL_ERROR;
+}
+
+ulapi_integer ulapi_wait_guard_get(void)
+{
+  return 0;
+}
+
 void ulapi_task_exit(ulapi_integer retval)
 {
   ptrdiff_t p = retval;	/* ptrdiff_t is an integer the same size as a pointer */
@@ -420,7 +688,7 @@ ulapi_result ulapi_task_join(ulapi_task_struct *task, ulapi_integer *retptr)
   ulapi_integer retval;
   int ret;
 
-  ret = pthread_join(*((ulapi_task_struct *) task), (void **) &retval);
+  ret = pthread_join(task->tid, (void **) &retval);
 
   if (0 == ret) {
     if (NULL != retptr) {
@@ -880,16 +1148,17 @@ typedef struct {
   void * addr;
 } shm_struct;
 
-void * ulapi_shm_new(ulapi_id key, ulapi_integer size)
+static void * shm_get(ulapi_id key, ulapi_integer size, int flags)
 {
   shm_struct * shm;
 
   shm = malloc(sizeof(shm_struct));
   if (NULL == (void *) shm) return NULL;
 
-  shm->id = shmget((key_t) key, (int) size, IPC_CREAT | 0666);
+  shm->id = shmget((key_t) key, (int) size, flags);
   if (-1 == shm->id) {
-    PERROR("shmget");
+    /* not there to attach to is for the caller to report */
+    if (ENOENT != errno) PERROR("shmget");
     free(shm);
     return NULL;
   }
@@ -904,6 +1173,16 @@ void * ulapi_shm_new(ulapi_id key, ulapi_integer size)
   return (void *) shm;
 }
 
+void * ulapi_shm_new(ulapi_id key, ulapi_integer size)
+{
+  return shm_get(key, size, IPC_CREAT | 0666);
+}
+
+void * ulapi_shm_attach(ulapi_id key, ulapi_integer size)
+{
+  return shm_get(key, size, 0);
+}
+
 void * ulapi_shm_addr(void * shm)
 {
   return ((shm_struct *) shm)->addr;